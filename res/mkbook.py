@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+# Build the opening book image for the spiffs partition from a polyglot .bin:
+#   magic "PGK1", entry count, the 781 polyglot Random64 keys, then the sorted entries (all big endian)
+# usage: mkbook.py book.bin book.img
+#        parttool.py write_partition --partition-name spiffs --input book.img
+
+import struct
+import sys
+
+import chess.polyglot  # pip install chess, for POLYGLOT_RANDOM_ARRAY
+
+PARTITION_SIZE = 0x160000
+
+def main(src, dst):
+    data = open(src, "rb").read()
+    entries = sorted(data[i:i + 16] for i in range(0, len(data) - len(data) % 16, 16))
+    image = struct.pack(">4sI", b"PGK1", len(entries))
+    image += b"".join(struct.pack(">Q", key) for key in chess.polyglot.POLYGLOT_RANDOM_ARRAY)
+    image += b"".join(entries)
+    if len(image) > PARTITION_SIZE:
+        sys.exit("book too large: %u > %u bytes" % (len(image), PARTITION_SIZE))
+    open(dst, "wb").write(image)
+    print("%u entries, %u bytes" % (len(entries), len(image)))
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: mkbook.py book.bin book.img")
+    main(sys.argv[1], sys.argv[2])
@@ -1,4 +1,6 @@
 
+#include <esp_timer.h>
+
 #include "globals.h"
 #include "mfrc522/mfrc522.h"
 
@@ -10,6 +12,19 @@
 namespace brd
 {
 
+#define SCAN_IDENTITY_PASSES        (16) // occupied squares are read again at least every that many scans
+#define SCAN_ADAPTIVE               (1)  // hot squares checked on every scan, the quiet ones by slices
+#define SCAN_QUIET_PASSES           (4)  // quiet squares are checked at least every that many scans (divides 8)
+#define SCAN_HOT_MS                 (2000) // toggled squares stay hot for that long
+#define PRESENCE_TIMEOUT            (40) // REQA timer reload in 25us ticks, the ATQA comes within 0.1ms
+#define TAG_CACHE_SIZE              (40) // learned tags, 32 pieces and some spares
+#define TAG_CACHE_NVS               (1)  // learned tags kept across restarts
+#define TAG_CACHE_SAVE_MS           (3000) // saved once the board is quiet for that long
+#define TAG_UID_SIZE                (7)  // NTAG213
+#define SCAN_TIMING                 (0)  // per-phase scan durations in the log, debug builds
+#define SCAN_TIMING_PASSES          (64) // scans per log line
+#define EVENT_QUEUE_SIZE            (64) // power of 2
+
 static enum {
     BRD_STATE_INIT,
     BRD_STATE_SCAN,
@@ -24,6 +39,42 @@ static uint32_t     au32_toggle_ms[64];
 static uint8_t      u8_selected_file;
 static uint8_t      u8_selected_rank;
 
+/* tag UID to piece, the data page is read only for unknown tags */
+typedef struct {
+    uint8_t     au8_uid[TAG_UID_SIZE];
+    uint8_t     u8_piece;       // 0 if unused
+} tag_st;
+
+static struct {
+    tag_st      tags[TAG_CACHE_SIZE];
+    uint8_t     u8_next;        // replaced when full
+    nvs_handle_t nvs;           // 0 if not persisted
+    bool        b_dirty;        // learned since the last save
+} s_cache;
+
+/* square changes, a plain ring: scan() pushes and chess::loop() pops, both in the Board task */
+static struct {
+    square_event_st events[EVENT_QUEUE_SIZE];
+    uint32_t    u32_head;       // next to push
+    uint32_t    u32_tail;       // next to pop
+    bool        b_overflow;
+} s_events;
+
+#if SCAN_TIMING
+/* accumulated over SCAN_TIMING_PASSES scans */
+static struct {
+    uint32_t    u32_scans;
+    uint32_t    u32_checks;     // presence checks
+    uint32_t    u32_reads;      // squares read in full
+    int64_t     us_reset;       // rank hard resets
+    int64_t     us_wake;        // waiting for a reader to wake up
+    int64_t     us_total;
+} s_timing;
+#define TIMING_ADD(field, value)    (s_timing.field += (value))
+#else
+#define TIMING_ADD(field, value)    ((void)(value)) // no accounting in the shipped build
+#endif
+
 
 // set column
 static inline void select_file(uint8_t file)
@@ -46,7 +97,87 @@ static inline void select_rank(uint8_t rank)
 
 static bool checkSquares(void);
 static void animate_squares(void);
-static uint32_t scan(void);
+static uint32_t scan(uint64_t u64_hot);
+
+static void tag_cache_load(void)
+{
+#if TAG_CACHE_NVS
+    size_t len = sizeof(s_cache.tags);
+
+    if (ESP_OK != nvs_open("board", NVS_READWRITE, &s_cache.nvs))
+    {
+        LOGW("nvs_open failed");
+        s_cache.nvs = 0;
+    }
+    else if ((ESP_OK != nvs_get_blob(s_cache.nvs, "tags", s_cache.tags, &len)) || (sizeof(s_cache.tags) != len))
+    {
+        memset(s_cache.tags, 0, sizeof(s_cache.tags));
+    }
+#endif
+}
+
+static void tag_cache_clear(void)
+{
+    memset(s_cache.tags, 0, sizeof(s_cache.tags));
+    s_cache.u8_next = 0;
+    s_cache.b_dirty = false;
+#if TAG_CACHE_NVS
+    if (0 != s_cache.nvs)
+    {
+        (void)nvs_erase_key(s_cache.nvs, "tags");
+        (void)nvs_commit(s_cache.nvs);
+    }
+#endif
+}
+
+// UID from page 0 (UID0-2, BCC0, UID3-6), cached piece or 0
+static uint8_t tag_piece(const uint8_t *page0, uint8_t *uid)
+{
+    memcpy(uid, page0, 3);
+    memcpy(uid + 3, page0 + 4, TAG_UID_SIZE - 3);
+
+    for (uint8_t i = 0; i < TAG_CACHE_SIZE; i++)
+    {
+        if (s_cache.tags[i].u8_piece && (0 == memcmp(s_cache.tags[i].au8_uid, uid, TAG_UID_SIZE)))
+            return s_cache.tags[i].u8_piece;
+    }
+
+    return 0;
+}
+
+static void tag_learn(const uint8_t *uid, uint8_t piece)
+{
+    uint8_t i = 0;
+
+    while ((i < TAG_CACHE_SIZE) && (0 != s_cache.tags[i].u8_piece)) {
+        i++;
+    }
+    if (TAG_CACHE_SIZE == i) {
+        i = s_cache.u8_next;
+        s_cache.u8_next = (i + 1) % TAG_CACHE_SIZE;
+    }
+
+    memcpy(s_cache.tags[i].au8_uid, uid, TAG_UID_SIZE);
+    s_cache.tags[i].u8_piece = piece;
+    //LOGD("tag %02x%02x%02x%02x%02x%02x%02x is %c", uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], piece);
+    s_cache.b_dirty = true; // saved by tag_cache_save(), not in the middle of a scan
+}
+
+// flash writes stall the scan, wait until no square toggled for a while
+static void tag_cache_save(uint32_t ms_last_toggle)
+{
+    if (!s_cache.b_dirty || (millis() - ms_last_toggle < TAG_CACHE_SAVE_MS))
+        return;
+
+    s_cache.b_dirty = false;
+#if TAG_CACHE_NVS
+    if ((0 != s_cache.nvs) &&
+        ((ESP_OK != nvs_set_blob(s_cache.nvs, "tags", s_cache.tags, sizeof(s_cache.tags))) || (ESP_OK != nvs_commit(s_cache.nvs))))
+    {
+        LOGW("tags not saved");
+    }
+#endif
+}
 
 bool init()
 {
@@ -57,6 +188,8 @@ bool init()
     select_rank(0);
     select_file(0);
 
+    tag_cache_load();
+
     e_state = BRD_STATE_INIT;
 
     return true;
@@ -71,7 +204,7 @@ void loop()
         if (checkSquares() && checkSquares()) // check 2x
         {
             animate_squares();
-            scan(); // initial scan
+            scan(~0ULL); // initial scan
             e_state = BRD_STATE_SCAN;
         }
         else
@@ -85,12 +218,16 @@ void loop()
         {
             LOGD("restart");
             MAIN_BTN.resetCount();
+            tag_cache_clear(); // relearn rewritten tags
             e_state = BRD_STATE_INIT;
         }
         else
         {
+            static uint64_t u64_hot = ~0ULL;
             //uint32_t ms_start = millis();
-            chess::loop(scan());
+            uint32_t ms_last_toggle = scan(u64_hot);
+            u64_hot = chess::loop(ms_last_toggle);
+            tag_cache_save(ms_last_toggle);
             //LOGD("scan duration %lu ms", millis() - ms_start);
         }
 
@@ -112,6 +249,38 @@ const uint32_t *pu32_toggle_ms(void)
     return au32_toggle_ms;
 }
 
+static inline void push_event(uint8_t idx, uint8_t u8_old, uint8_t u8_new)
+{
+    if (s_events.u32_head - s_events.u32_tail >= EVENT_QUEUE_SIZE)
+    {
+        s_events.b_overflow = true;
+        return;
+    }
+
+    square_event_st *event = &s_events.events[s_events.u32_head++ & (EVENT_QUEUE_SIZE - 1)];
+    event->ms_time = au32_toggle_ms[idx];
+    event->u8_idx  = idx;
+    event->u8_old  = u8_old;
+    event->u8_new  = u8_new;
+}
+
+bool pop_event(square_event_st *event)
+{
+    if (s_events.u32_tail == s_events.u32_head)
+        return false;
+
+    memcpy(event, &s_events.events[s_events.u32_tail++ & (EVENT_QUEUE_SIZE - 1)], sizeof(square_event_st));
+    return true;
+}
+
+bool events_overflow(void)
+{
+    bool b_overflow = s_events.b_overflow;
+
+    s_events.b_overflow = false;
+    return b_overflow;
+}
+
 
 static bool checkSquares(void)
 {
@@ -211,28 +380,48 @@ static void animate_squares(void)
     }
 }
 
-static inline void square_init(void)
+static inline int64_t timing_us(void)
 {
-#if 0
-    rc522.PCD_Init();
+#if SCAN_TIMING
+    return esp_timer_get_time();
 #else
+    return 0;
+#endif
+}
+
+static inline void rank_reset(uint8_t rank)
+{
+    int64_t us_start = timing_us();
+
+    select_rank(rank);
+    rc522.PCF_HardReset();
+
+    TIMING_ADD(us_reset, timing_us() - us_start);
+}
+
+// soft-reset of the selected reader, it wakes up while another square is served
+static inline void square_wake(void)
+{
+    rc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_SoftReset);
+}
+
+// wait for the reader woken up by square_wake() then set it up
+static inline void square_ready(void)
+{
     // wait for 150ms to be ready
     uint32_t    ms_timeout  = millis() + 150;
-    uint8_t     u8_cmdreg   = 0;
+    int64_t     us_start    = timing_us();
+    uint8_t     u8_cmdreg;
 
-    // do soft-reset
-    rc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_SoftReset);
-    do {
-        delayms(1);
-        u8_cmdreg = rc522.PCD_ReadRegister(MFRC522::CommandReg);
-        if (0 == (u8_cmdreg & 0x10)) { // check if powerdown bit is cleared
-            break; // reader is now ready
+    while (0 != ((u8_cmdreg = rc522.PCD_ReadRegister(MFRC522::CommandReg)) & 0x10)) // powerdown bit
+    {
+        if (millis() >= ms_timeout) {
+            LOGW("square %c%u not ready (cmdreg 0x%02x)", 'a' + u8_selected_file, u8_selected_rank + 1, u8_cmdreg);
+            break;
         }
-    } while (millis() < ms_timeout);
-
-    if (0 != (u8_cmdreg & 10)) {
-        LOGW("square %c%u not ready (cmdreg 0x%02x)", 'a' + u8_selected_file, u8_selected_rank + 1, u8_cmdreg);
+        delayms(1);
     }
+    TIMING_ADD(us_wake, timing_us() - us_start);
 
     rc522.PCD_WriteRegister(MFRC522::TModeReg, 0x80);
     rc522.PCD_WriteRegister(MFRC522::TPrescalerReg, 0xA9);
@@ -242,6 +431,16 @@ static inline void square_init(void)
     rc522.PCD_WriteRegister(MFRC522::TxASKReg, 0x40);
     rc522.PCD_WriteRegister(MFRC522::ModeReg, 0x3D);
     rc522.PCD_AntennaOn();
+}
+
+static inline void square_init(void)
+{
+#if 0
+    rc522.PCD_Init();
+#else
+    square_wake();
+    delayms(1);
+    square_ready();
 #endif
 }
 
@@ -271,11 +470,26 @@ static inline bool has_piece(void)
     return ((MFRC522::STATUS_OK == result) || (MFRC522::STATUS_COLLISION == result));
 }
 
+// REQA only, with a short timeout as most misses are empty squares (reader ready)
+static inline bool square_present(void)
+{
+    bool b_present;
+
+    rc522.PCD_WriteRegister(MFRC522::TReloadRegH, 0x00);
+    rc522.PCD_WriteRegister(MFRC522::TReloadRegL, PRESENCE_TIMEOUT);
+    b_present = has_piece();
+    square_deinit();
+
+    return b_present;
+}
+
 static inline uint8_t read_piece(uint16_t u8_expected_piece, uint8_t u8_retry, bool b_init)
 {
     MFRC522::StatusCode status;
     uint8_t             buffer[16 + 2 /*crc*/]; // minimum
     uint8_t             size;
+    uint8_t             uid[TAG_UID_SIZE];
+    uint8_t             u8_piece = 0;
 
     if (b_init)
     {
@@ -299,7 +513,8 @@ static inline uint8_t read_piece(uint16_t u8_expected_piece, uint8_t u8_retry, b
         }
     }
     else if ((16 > (size = sizeof(buffer))) || (MFRC522::STATUS_OK != (status = rc522.MIFARE_Read(0, buffer, &size))) ||
-             (16 > (size = sizeof(buffer))) || (MFRC522::STATUS_OK != (status = rc522.MIFARE_Read(NTAG_DATA_START_PAGE, buffer, &size))))
+             ((0 == (u8_piece = tag_piece(buffer, uid))) &&
+              ((16 > (size = sizeof(buffer))) || (MFRC522::STATUS_OK != (status = rc522.MIFARE_Read(NTAG_DATA_START_PAGE, buffer, &size))))))
     {
         if (u8_retry > 0)
         //if ((u8_retry > 0) && ((MFRC522::STATUS_TIMEOUT==status) || (MFRC522::STATUS_CRC_WRONG==status)))
@@ -313,7 +528,13 @@ static inline uint8_t read_piece(uint16_t u8_expected_piece, uint8_t u8_retry, b
     }
     else
     {
-        uint8_t u8_piece = buffer[NTAG_DATA_PIECE_OFFSET];
+        if (0 == u8_piece) // unknown tag
+        {
+            u8_piece = buffer[NTAG_DATA_PIECE_OFFSET];
+            if (VALID_PIECE(PIECE_TYPE(u8_piece))) {
+                tag_learn(uid, u8_piece);
+            }
+        }
         uint8_t u7_type  = PIECE_TYPE(u8_piece);
         //uint8_t b_color  = PIECE_COLOR(u8_piece);
         if (VALID_PIECE(u7_type))
@@ -331,52 +552,160 @@ static inline uint8_t read_piece(uint16_t u8_expected_piece, uint8_t u8_retry, b
     return 0;
 }
 
-static uint32_t scan(void)
+// files of the rank whose occupancy differs from au8_pieces
+static uint8_t presence_rank(uint8_t rank, uint8_t u8_files)
+{
+    uint8_t u8_changed = 0;
+
+    rank_reset(rank);
+    select_file(__builtin_ctz(u8_files));
+    square_wake();
+
+    while (0 != u8_files)
+    {
+        uint8_t file = __builtin_ctz(u8_files);
+
+        u8_files &= u8_files - 1;
+        if (0 != u8_files) { // wakes up during this square
+            select_file(__builtin_ctz(u8_files));
+            square_wake();
+        }
+        select_file(file);
+        square_ready();
+        TIMING_ADD(u32_checks, 1);
+
+        if (square_present() != (0 != au8_pieces[(rank<<3) + file])) {
+            u8_changed |= 1 << file; // or unknown tag
+        }
+    }
+
+    return u8_changed;
+}
+
+// squares to check on this pass: the hot ones, the recently toggled ones and a slice of the others
+static uint64_t schedule_squares(uint64_t u64_hot, uint8_t u8_pass)
+{
+#if SCAN_ADAPTIVE
+    static_assert(0 == (8 % SCAN_QUIET_PASSES), "SCAN_QUIET_PASSES");
+    static const uint8_t RANKS_PER_SLICE = 8 / SCAN_QUIET_PASSES;
+    uint32_t ms_now = millis();
+    uint64_t u64_checks = u64_hot;
+
+    u64_checks |= (~0ULL >> (64 - (RANKS_PER_SLICE << 3))) << (((u8_pass % SCAN_QUIET_PASSES) * RANKS_PER_SLICE) << 3);
+    for (uint8_t idx = 0; idx < 64; idx++)
+    {
+        if (ms_now - au32_toggle_ms[idx] < SCAN_HOT_MS) {
+            u64_checks |= 1ULL << idx;
+        }
+    }
+
+    return u64_checks;
+#else
+    (void)u64_hot;
+    (void)u8_pass;
+    return ~0ULL;
+#endif
+}
+
+static void read_rank(uint8_t rank, uint8_t u8_files, uint32_t *p_ms_toggle)
 {
     static const uint8_t MAX_READ_RETRIES = 16;
-    static uint32_t ms_last_toggle = 0;
 
-    for (uint8_t rank = 0; rank < 8; rank++)
+    rank_reset(rank);
+    select_file(__builtin_ctz(u8_files));
+    square_wake();
+
+    while (0 != u8_files)
     {
-        select_rank(rank);
-        rc522.PCF_HardReset();
+        uint8_t file  = __builtin_ctz(u8_files);
+        uint8_t idx   = (rank<<3) + file;
 
-        for (uint8_t file = 0; file < 8; file++)
-        {
-            select_file(file);
+        u8_files &= u8_files - 1;
+        if (0 != u8_files) { // wakes up during this square
+            select_file(__builtin_ctz(u8_files));
+            square_wake();
+        }
+        select_file(file);
+        square_ready();
+        TIMING_ADD(u32_reads, 1);
 
-            uint8_t idx   = (rank<<3) + file;
-            uint8_t piece = read_piece(au8_pieces[idx], MAX_READ_RETRIES, true);
+        uint8_t piece = read_piece(au8_pieces[idx], MAX_READ_RETRIES, false);
 
+        if (au8_pieces[idx] != piece)
+        {
+            uint8_t piece_check = read_piece(au8_pieces[idx], MAX_READ_RETRIES, true);
+
+            if (piece != piece_check) // re-read
+            {
+                //LOGD("re-check %02x vs %02x on %c%u", piece, piece_check, 'a' + file, rank + 1);
+                piece_check = read_piece(piece, MAX_READ_RETRIES, true);
+            }
+            if ((piece != piece_check) && (au8_pieces[idx] != piece_check)) // verify x2
+            {
+                LOGW("verify failed %02x vs %02x on %c%u", piece, piece_check, 'a' + file, rank + 1);
+            }
+            piece = piece_check; // ignore further errors
             if (au8_pieces[idx] != piece)
             {
-                uint8_t piece_check = read_piece(au8_pieces[idx], MAX_READ_RETRIES, true);
-
-                if (piece != piece_check) // re-read
-                {
-                    //LOGD("re-check %02x vs %02x on %c%u", piece, piece_check, 'a' + file, rank + 1);
-                    piece_check = read_piece(piece, MAX_READ_RETRIES, true);
-                }
-                if ((piece != piece_check) && (au8_pieces[idx] != piece_check)) // verify x2
-                {
-                    LOGW("verify failed %02x vs %02x on %c%u", piece, piece_check, 'a' + file, rank + 1);
-                }
-                piece = piece_check; // ignore further errors
-                if (au8_pieces[idx] != piece)
-                {
-                    au32_toggle_ms[idx] = millis();
-                    //LOGD("toggle %c on %c%u", piece ? piece : '-', 'a' + file, rank + 1);
-                    ms_last_toggle = au32_toggle_ms[idx];
-                }
+                au32_toggle_ms[idx] = millis();
+                //LOGD("toggle %c on %c%u", piece ? piece : '-', 'a' + file, rank + 1);
+                *p_ms_toggle = au32_toggle_ms[idx];
+                push_event(idx, au8_pieces[idx], piece);
             }
+        }
 
-            au8_pieces[idx] = piece;
+        au8_pieces[idx] = piece;
 
-            square_deinit();
+        square_deinit();
+    }
+}
+
+static uint32_t scan(uint64_t u64_hot)
+{
+    static uint32_t ms_last_toggle = 0;
+    static uint8_t  u8_pass = 0;
+    uint64_t        u64_reads = ~0ULL; // squares read in full
+    int64_t         us_start = timing_us();
+
+    // presence sweep, pages are read only where the occupancy changed
+    if (0 != (u8_pass % SCAN_IDENTITY_PASSES))
+    {
+        uint64_t u64_checks = schedule_squares(u64_hot, u8_pass);
+
+        u64_reads = 0;
+        for (uint8_t rank = 0; rank < 8; rank++)
+        {
+            uint8_t u8_files = 0xFF & (u64_checks >> (rank<<3));
+            if (0 != u8_files) {
+                u64_reads |= (uint64_t)presence_rank(rank, u8_files) << (rank<<3);
+            }
         }
+    }
+    u8_pass++;
 
+    for (uint8_t rank = 0; (rank < 8) && (0 != u64_reads); rank++)
+    {
+        uint8_t u8_files = 0xFF & (u64_reads >> (rank<<3));
+        if (0 != u8_files) {
+            read_rank(rank, u8_files, &ms_last_toggle);
+        }
     }
     //LOGD("scan done");
+
+#if SCAN_TIMING
+    s_timing.us_total += timing_us() - us_start;
+    if (++s_timing.u32_scans >= SCAN_TIMING_PASSES)
+    {
+        uint32_t n = s_timing.u32_scans;
+        LOGD("scan %lu us: reset %lu wake %lu rf %lu, %lu checks %lu reads/scan", (unsigned long)(s_timing.us_total / n),
+            (unsigned long)(s_timing.us_reset / n), (unsigned long)(s_timing.us_wake / n),
+            (unsigned long)((s_timing.us_total - s_timing.us_reset - s_timing.us_wake) / n),
+            (unsigned long)(s_timing.u32_checks / n), (unsigned long)(s_timing.u32_reads / n));
+        memset(&s_timing, 0, sizeof(s_timing));
+    }
+#else
+    (void)us_start;
+#endif
     return ms_last_toggle;
 }
 
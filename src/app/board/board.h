@@ -17,10 +17,20 @@ namespace brd
 // terminator   (tag 0xfe len 0) : fe
 #define NTAG_DATA_PIECE_OFFSET      (14)  // e.g. the 0x6b ('k') value
 
+/* square change, published by scan() */
+typedef struct {
+    uint32_t    ms_time;        // au32_toggle_ms of the square
+    uint8_t     u8_idx;         // scan index (a1 = 0)
+    uint8_t     u8_old;         // piece, 0 if empty
+    uint8_t     u8_new;
+} square_event_st;
+
 bool init();
 void loop();
 
 const uint8_t *pu8_pieces(void);
 const uint32_t *pu32_toggle_ms(void);
+bool pop_event(square_event_st *event); // Board task only (chess::loop), false if none
+bool events_overflow(void); // events were dropped since the last call, pu8_pieces() is the reference
 
 } // namespace brd
@@ -1,4 +1,8 @@
 
+#include <stdlib.h>
+
+#include <esp_random.h>
+
 #include "globals.h"
 #include "board/board.h"
 #include "ui/ui.h"
@@ -14,19 +18,68 @@ static game_st          s_game;
 SemaphoreHandle_t       mtx = NULL;
 static move_st          last_move;
 static move_st          pending_move;
+static pgn_st           s_pgn;          // moves since the first one of the game
+
+/* legal moves of the current position and of the one a ply back (continuation) */
+static struct {
+    uint64_t     key;
+    bool         b_valid;
+    move_list_st list;
+} s_moves_cache[2];
+static uint8_t          u8_cache_last = 0;  // slot used last
+static uint32_t         u32_cache_hits = 0;
+static uint32_t         u32_cache_misses = 0;
 
 static const uint8_t   *pu8_pieces = NULL;
 static uint8_t          au8_prev_pieces[64];
+static uint64_t         u64_prev_diff = 0;  // squares of pu8_pieces differing from au8_prev_pieces
+static EventGroupHandle_t position_events = NULL;
+static uint32_t         u32_position_seq = 0; // bumped on each position change
+#define POSITION_CHANGED_BIT    (1 << 0)
 static char             ac_fen_buf[FEN_BUFF_LEN];
-static char             ac_pgn_buf[PGN_BUFF_LEN];
 static bool             b_pending_led = false;
 static bool             b_skip_start_fen = false;
 static bool             b_valid_posision = false;
-
-static struct {
-    char san_black[16];
-    char san_white[16];
-} s_move_stack[256];
+static uint8_t          u8_result = RESULT_NONE; // result_et of the current position, set once the game is over
+static uint8_t          u8_claimable = RESULT_NONE; // draw the players may claim, the game goes on
+static bool             b_hints = true;     // book moves on leds and display
+static bool             b_chess960 = false; // castling sent as king takes rook
+static move_st          as_book_moves[2];   // heaviest first
+static uint8_t          u8_book_count = 0;
+static uint64_t         u64_book_key = 0;   // position of as_book_moves
+static char             ac_book_san[16];
+static char             ac_last_san[16];    // of last_move, with check suffix
+
+/* engine analysis of the current position, off the board task */
+#define ENGINE_TT_BITS          (15)        // 32k entries, 384 kB
+#define ENGINE_BUDGET_MS        (2000)
+#define ENGINE_IDLE_MS          (1000)      // longest wait for a position change
+static game_st          s_engine_game;      // searched copy of s_game
+static search_result_st s_analysis;
+static uint64_t         u64_analysis_key = 0; // position of s_analysis
+static char             ac_analysis_san[8];
+static bool             b_analysis_shown = true;
+
+/* engine opponent, by level */
+typedef struct {
+    uint8_t  depth;
+    uint16_t ms_budget;
+    bool     b_book;            // weighted random book move first
+} engine_level_st;
+
+static const engine_level_st AS_ENGINE_LEVELS[ENGINE_LEVELS] = {
+    { 1,   200, false },
+    { 2,   300, false },
+    { 3,   500, false },
+    { 4,  1000, true  },
+    { 5,  2000, true  },
+    { 6,  3000, true  },
+    { 8,  5000, true  },
+    { SEARCH_MAX_PLY, 10000, true }
+};
+static uint8_t          u8_engine_level = 0; // 1 .. ENGINE_LEVELS, 0 if no engine opponent
+static uint8_t          u8_engine_color = BLACK;
+static uint64_t         u64_reply_key = 0;  // position of the last reply
 
 
 static uint8_t AU8_START_PIECES[64] =
@@ -52,10 +105,63 @@ static inline void unlock(void)
     (void)xSemaphoreGive(mtx);
 }
 
+static inline void notify_position(void)
+{
+    __atomic_add_fetch(&u32_position_seq, 1, __ATOMIC_RELEASE);
+    if (NULL != position_events) {
+        (void)xEventGroupSetBits(position_events, POSITION_CHANGED_BIT);
+    }
+}
+
+static inline void set_prev_pieces(const uint8_t *pieces)
+{
+    if (pieces != au8_prev_pieces) {
+        memcpy(au8_prev_pieces, pieces, sizeof(au8_prev_pieces));
+    }
+    u64_prev_diff = 0;
+    for (uint8_t i = 0; i < 64; i++)
+    {
+        if (pu8_pieces[i] != au8_prev_pieces[i]) {
+            u64_prev_diff |= 1ULL << i;
+        }
+    }
+}
+
+// the square changes of the scans since the last loop
+static inline void update_diff(void)
+{
+    brd::square_event_st event;
+
+    while (brd::pop_event(&event))
+    {
+        if (event.u8_new != au8_prev_pieces[event.u8_idx]) {
+            u64_prev_diff |= 1ULL << event.u8_idx;
+        } else {
+            u64_prev_diff &= ~(1ULL << event.u8_idx);
+        }
+    }
+
+    if (brd::events_overflow()) {
+        set_prev_pieces(au8_prev_pieces); // resync on the scan
+    }
+}
+
 static inline uint8_t count_pieces(const uint8_t u8_piece, uint8_t *pau8_sqs=NULL, uint8_t u8_max=0)
 {
     uint8_t u8_count = 0;
 
+#if BITBOARDS
+    uint64_t u64_bits = s_game.bitboards[PIECE_COLOR(u8_piece)][BB_INDEX(PIECE_TYPE(u8_piece))];
+
+    while (0 != u64_bits)
+    {
+        if ((u8_count < u8_max) && (NULL != pau8_sqs)) {
+            pau8_sqs[u8_count] = IDX_TO_SQUARE(__builtin_ctzll(u64_bits));
+        }
+        u64_bits &= u64_bits - 1; // next
+        u8_count++;
+    }
+#else
     for (uint8_t rank = 0; rank < 8; rank++)
     {
         for (uint8_t file = 0; file < 8; file++)
@@ -70,6 +176,7 @@ static inline uint8_t count_pieces(const uint8_t u8_piece, uint8_t *pau8_sqs=NUL
             }
         }
     }
+#endif
 
     return u8_count;
 }
@@ -149,11 +256,42 @@ static inline bool validate_position(void)
     return b_valid;
 }
 
+static inline void invalidate_moves(void)
+{
+    s_moves_cache[0].b_valid = false;
+    s_moves_cache[1].b_valid = false;
+}
+
+static inline const move_list_st *legal_moves(void)
+{
+    for (uint8_t slot = 0; slot < 2; slot++)
+    {
+        if (s_moves_cache[slot].b_valid && (s_moves_cache[slot].key == s_game.stats.key))
+        {
+            u32_cache_hits++;
+            u8_cache_last = slot;
+            return &s_moves_cache[slot].list;
+        }
+    }
+
+    // replace the slot not used last
+    u32_cache_misses++;
+    u8_cache_last ^= 1;
+    s_moves_cache[u8_cache_last].key = s_game.stats.key;
+    s_moves_cache[u8_cache_last].b_valid = true;
+    generate_moves(&s_game, &s_moves_cache[u8_cache_last].list);
+
+    return &s_moves_cache[u8_cache_last].list;
+}
+
 static inline bool load_position(const uint8_t *raw, bool initial)
 {
     if (initial)
     {
-        memset(&s_game, 0, sizeof(s_game));
+        init_game(&s_game); // standard rook files
+        pgn_clear(&s_pgn);
+        u8_result = RESULT_NONE;
+        u8_claimable = RESULT_NONE;
     }
 
     for (uint8_t rank = 0; rank < 8; rank++)
@@ -179,8 +317,11 @@ static inline bool load_position(const uint8_t *raw, bool initial)
         // default to white's turn
         s_game.stats.turn = WHITE;
 
-    #if 1 // castling rights (not accurate)
-        if (MAKE_PIECE(WHITE, KING) == s_game.board[e1])
+    #if 1 // castling rights (not accurate, but on a start position)
+        if (chess960_position(&s_game)) {
+            (void)parse_castling(&s_game, "KQkq"); // outermost rooks, the standard start too
+        }
+        else if (MAKE_PIECE(WHITE, KING) == s_game.board[e1])
         {
             if (MAKE_PIECE(WHITE, ROOK) == s_game.board[a1]) {
                 s_game.stats.castling[WHITE] |= BIT_QSIDE_CASTLE;
@@ -217,8 +358,10 @@ static inline bool load_position(const uint8_t *raw, bool initial)
     }
 
     LOGD("fen: %s", generate_fen(&s_game));
+    invalidate_moves();
+    notify_position();
 
-    return validate_position();
+    return index_position(&s_game) && validate_position();
 }
 
 void init(void)
@@ -227,23 +370,29 @@ void init(void)
     {
         mtx = xSemaphoreCreateMutex();
         assert(NULL != mtx);
+        position_events = xEventGroupCreate();
+        assert(NULL != position_events);
 
         pu8_pieces = brd::pu8_pieces();
+        (void)book_open("spiffs");
     }
 
     init_game(&s_game);
+    invalidate_moves();
 
     memset(&last_move, 0, sizeof(move_st));
     memset(&pending_move, 0, sizeof(move_st));
 
-    memset(&s_move_stack, 0, sizeof(s_move_stack));
-    strncpy(s_move_stack[0].san_white, "...", 15);
-    strncpy(s_move_stack[0].san_black, "...", 15);
+    pgn_clear(&s_pgn);
 
     b_pending_led    = false;
     b_skip_start_fen = false;
     b_valid_posision = false;
-
+    u8_result        = RESULT_NONE;
+    u8_claimable     = RESULT_NONE;
+    u64_analysis_key = 0;
+    memset(ac_last_san, 0, sizeof(ac_last_san));
+    notify_position();
 }
 
 static inline void show_turn(void)
@@ -257,14 +406,9 @@ static inline void show_turn(void)
     state = !state; // blink
 }
 
-static inline void show_diff(const uint8_t *prev)
+static inline void show_diff(void)
 {
-    for (uint8_t i = 0; i < 64; i++)
-    {
-        if (pu8_pieces[i] != prev[i]) {
-            ui::leds::setColor(i>>3, i&7, ui::leds::LED_RED);
-        }
-    }
+    ui::leds::setColors(u64_prev_diff, ui::leds::LED_RED);
 }
 
 static inline void show_checked(void)
@@ -305,6 +449,57 @@ static inline void show_move(void)
     }
 }
 
+static inline void lookup_book(void)
+{
+    if (u64_book_key != s_game.stats.key)
+    {
+        const move_list_st *list = legal_moves();
+        uint16_t au16_weights[2];
+        char *san = ac_book_san;
+
+        u64_book_key  = s_game.stats.key;
+        u8_book_count = book_moves(&s_game, list, as_book_moves, au16_weights, 2);
+
+        memset(ac_book_san, 0, sizeof(ac_book_san));
+        for (uint8_t i = 0; i < u8_book_count; i++) {
+            move_to_san(list, &as_book_moves[i], san, 7);
+            san += strlen(san);
+            *san++ = ' ';
+        }
+    }
+}
+
+static inline void show_hints(void)
+{
+    if (b_hints && (0 == pending_move.piece))
+    {
+        lookup_book();
+        if (u8_book_count) {
+            ui::leds::setColor(as_book_moves[0].from, ui::leds::LED_ORANGE);
+            ui::leds::setColor(as_book_moves[0].to, ui::leds::LED_ORANGE);
+        } else if ((u64_analysis_key == s_game.stats.key) && s_analysis.best.piece) {
+            ui::leds::setColor(s_analysis.best.from, ui::leds::LED_ORANGE);
+            ui::leds::setColor(s_analysis.best.to, ui::leds::LED_ORANGE);
+        }
+    }
+}
+
+/* white's point of view, pawns or moves to mate */
+static inline void format_score(char *buf, uint8_t buf_sz, int16_t score)
+{
+    if (BLACK == s_game.stats.turn) {
+        score = -score;
+    }
+
+    char sign = (score < 0) ? '-' : '+';
+    score = abs(score);
+    if (score > SEARCH_MATE - SEARCH_MAX_PLY) {
+        snprintf(buf, buf_sz, "%cM%d", sign, (SEARCH_MATE - score + 1) / 2);
+    } else {
+        snprintf(buf, buf_sz, "%c%d.%02d", sign, score / 100, score % 100);
+    }
+}
+
 static inline void display_stats(const char *last_san)
 {
     const stats_st *stats = &s_game.stats;
@@ -313,19 +508,7 @@ static inline void display_stats(const char *last_san)
 
     *fen++ = stats->turn == WHITE ? 'w' : 'b';
     *fen++ = ' ';
-    if ((0 == stats->castling[WHITE]) && (0 == stats->castling[BLACK])) {
-        *fen++ = '-';
-    }
-    else {
-        if (stats->castling[WHITE] & BIT_KSIDE_CASTLE)
-            *fen++ = 'K';
-        if (stats->castling[WHITE] & BIT_QSIDE_CASTLE)
-            *fen++ = 'Q';
-        if (stats->castling[BLACK] & BIT_KSIDE_CASTLE)
-            *fen++ = 'k';
-        if (stats->castling[BLACK] & BIT_QSIDE_CASTLE)
-            *fen++ = 'q';
-    }
+    fen += format_castling(&s_game, fen);
 
     *fen++ = ' ';
     if (!stats->ep_square) {
@@ -342,18 +525,22 @@ static inline void display_stats(const char *last_san)
     fen += snprintf(fen, 8, "%u", stats->move_number);
 
     DISPLAY_CLEAR_ROW(20, 8);
-    DISPLAY_TEXT1(0, 20, "%.*s. %.*s", 14, tmp_fen, 6, last_san);
-
-#if 0 // to do
-    DISPLAY_CLEAR_ROW(44, 20);
-    //DISPLAY_TEXT2(0, 44, "%s %s", san_white, san_black);
-    DISPLAY_TEXT2(0, 44, "%.15s %.15s",
-                s_move_stack[(WHITE == stats->turn) && (stats->move_number > 1) ? (stats->move_number - 2) : (stats->move_number - 1)].san_white,
-                s_move_stack[(stats->move_number > 1) ? (stats->move_number - 2) : (stats->move_number - 1)].san_black);
-#endif
+    if (b_hints && u8_book_count && (u64_book_key == s_game.stats.key)) {
+        DISPLAY_TEXT1(0, 20, "bk %.11s. %.*s", ac_book_san, 6, last_san);
+    } else if ((RESULT_NONE == u8_result) && (RESULT_NONE != u8_claimable)) {
+        DISPLAY_TEXT1(0, 20, "1/2? %.9s. %.*s", result_to_string(u8_claimable), 6, last_san);
+    } else if (b_hints && (RESULT_NONE == u8_result) && (u64_analysis_key == s_game.stats.key)) {
+        char score[8];
+        format_score(score, sizeof(score), s_analysis.score);
+        DISPLAY_TEXT1(0, 20, "%s %.6s. %.*s", score, ac_analysis_san, 6, last_san);
+    } else if ((RESULT_NONE == u8_result) || (RESULT_CHECKMATE == u8_result)) {
+        DISPLAY_TEXT1(0, 20, "%.*s. %.*s", 14, tmp_fen, 6, last_san);
+    } else {
+        DISPLAY_TEXT1(0, 20, "1/2 %.10s. %.*s", result_to_string(u8_result), 6, last_san);
+    }
 }
 
-static inline void do_move(move_st *list, move_st *move)
+static inline void do_move(const move_list_st *list, move_st *move)
 {
     char san_buf[16] = {0, };
 
@@ -361,35 +548,46 @@ static inline void do_move(move_st *list, move_st *move)
         // set actual promoted piece
         move->promoted = PIECE_TYPE(pu8_pieces[SQUARE_TO_IDX(move->to)]);
         LOGD("promote to %c", toupper(move->promoted));
-        s_game.board[move->to] = move->promoted;
     }
 
+    if (0 == s_game.plies) {
+        pgn_init(&s_pgn, &s_game); // record from the position of the first move
+    } else {
+        pgn_truncate(&s_pgn, s_game.plies); // continuation replaces the last move
+    }
+
+    search_stop(); // analysis of the previous position
     make_move(&s_game, move);
     move_to_san(list, move, san_buf, sizeof(san_buf) - 1);
+    pgn_append(&s_pgn, move);
 
-    memcpy(au8_prev_pieces, pu8_pieces, sizeof(au8_prev_pieces));
+    set_prev_pieces(pu8_pieces);
     memcpy(&last_move, move, sizeof(move_st));
     memset(&pending_move, 0, sizeof(move_st));
 
-    move_st *next_moves = generate_moves(&s_game);
-    if (next_moves) {
-        if (IN_CHECK(&s_game)) {
-            strcat(san_buf, "+"); // in-check only
-        }
-        clear_moves(&next_moves);
-    } else if (IN_CHECK(&s_game)) {
+    // the list of the move stays cached for the continuation
+    u8_result = game_result(&s_game, legal_moves()->count);
+    u8_claimable = (RESULT_NONE == u8_result) ? claimable_draw(&s_game) : RESULT_NONE;
+    LOGD("moves cache %lu hits %lu misses", u32_cache_hits, u32_cache_misses);
+    if (b_hints) {
+        lookup_book();
+    }
+    s_pgn.result = u8_result;
+    if (RESULT_CHECKMATE == u8_result) {
         strcat(san_buf, "#"); // checkmate!
         LOGI("matyas!!!");
-    } else {
-        strcat(san_buf, "sm"); // stalemate
+    } else if (IN_CHECK(&s_game)) {
+        strcat(san_buf, "+"); // in-check only
+    }
+    if (RESULT_NONE != u8_result) {
+        LOGI("result: %s", result_to_string(u8_result));
+    } else if (RESULT_NONE != u8_claimable) {
+        LOGI("claimable: %s", result_to_string(u8_claimable));
     }
 
+    strcpy(ac_last_san, san_buf);
     LOGD("%-4s %s", san_buf, generate_fen(&s_game));
-    if (BLACK == s_game.stats.turn) {
-        strncpy(s_move_stack[s_game.stats.move_number - 1].san_white, san_buf, 16);
-    } else {
-        strncpy(s_move_stack[s_game.stats.move_number - 2].san_black, san_buf, 16);
-    }
+    notify_position();
     //DISPLAY_CLEAR();
     //DISPLAY_TEXT(4, 48, 1, "%s", san_buf);
     display_stats(san_buf);
@@ -397,31 +595,54 @@ static inline void do_move(move_st *list, move_st *move)
 
 static inline bool check_start_fen(void)
 {
-    uint8_t u8_diff = 0;
+    uint64_t u64_diff = 0;
 
     for (uint8_t u8_idx = 0; u8_idx < sizeof(AU8_START_PIECES); u8_idx++)
     {
         if (pu8_pieces[u8_idx] != AU8_START_PIECES[u8_idx])
         {
-            ui::leds::setColor(u8_idx>>3, u8_idx&7, ui::leds::LED_RED_LOW);
-            u8_diff++;
+            u64_diff |= 1ULL << u8_idx;
         }
     }
 
+    ui::leds::setColors(u64_diff, ui::leds::LED_RED_LOW);
     ui::leds::update();
-    return (0 == u8_diff);
+    return (0 == u64_diff);
 }
 
-void loop(uint32_t ms_last_changed)
+// squares likely to change next: the lifted pieces and their targets, else the movable pieces
+static inline uint64_t hot_squares(void)
 {
-    uint8_t au8_allowed_squares[28];
-    uint8_t u8_squares_count;
+    if (false == b_valid_posision) {
+        return ~0ULL; // setting up
+    }
+
+    const move_list_st *list = legal_moves();
+    uint64_t u64_hot = u64_prev_diff;
+
+    if (0 == u64_prev_diff) {
+        return list->origins;
+    }
+    for (uint64_t u64_lifted = u64_prev_diff & list->origins; 0 != u64_lifted; u64_lifted &= u64_lifted - 1) {
+        u64_hot |= list->targets[__builtin_ctzll(u64_lifted)];
+    }
+
+    return u64_hot;
+}
+
+uint64_t loop(uint32_t ms_last_changed)
+{
+    uint64_t u64_targets;
+    uint64_t u64_hot;
+    uint8_t  u8_lifted;
 
     ui::leds::clear();
 
     lock();
 
-    if (!s_game.history) // if no moves yet
+    update_diff();
+
+    if (0 == s_game.plies) // if no moves yet
     {
         // if upper-left button was pressed ...
         if ((millis() - ms_last_changed > 1000UL) && (MAIN_BTN.shortPressed()))
@@ -430,7 +651,10 @@ void loop(uint32_t ms_last_changed)
             b_skip_start_fen = true; // allow custom position
             if (b_valid_posision) {
                 s_game.stats.turn = SWAP_COLOR(s_game.stats.turn); // toggle turn
+                s_game.stats.key = position_key(&s_game);
+                invalidate_moves();
                 LOGD("new fen: %s", generate_fen(&s_game));
+                notify_position();
             }
         }
     }
@@ -440,29 +664,35 @@ void loop(uint32_t ms_last_changed)
     {
         if (b_skip_start_fen || check_start_fen())
         {
-            memcpy(au8_prev_pieces, pu8_pieces, sizeof(au8_prev_pieces));
+            set_prev_pieces(pu8_pieces);
             b_valid_posision = load_position(pu8_pieces, true);
             b_skip_start_fen = b_valid_posision;
         }
     }
-    else if (0 == memcmp(au8_prev_pieces, pu8_pieces, sizeof(au8_prev_pieces)))
+    else if (0 == u64_prev_diff)
     {
         s_game.stats.valid = true;
         //LOGD("no change yet");
         if ((0 == last_move.piece) && (0 == pending_move.piece)) {
             show_turn();
+            show_hints();
             display_stats("...");
         } else if (1) { //!hide_moves) {
             show_pending();
+            show_hints();
             show_move();
             show_checked();
+            if (!b_analysis_shown) {
+                display_stats(ac_last_san);
+            }
         }
+        b_analysis_shown = true;
         ui::leds::update();
     }
     else
     {
         move_st move;
-        move_st *moves_list = generate_moves(&s_game);
+        const move_list_st *moves_list = legal_moves();
 
         // exact move with blanking
   #define VALID_MOVE()      ((true == find_move(&s_game, moves_list, pu8_pieces, &move)) && \
@@ -475,22 +705,22 @@ void loop(uint32_t ms_last_changed)
             s_game.stats.valid = true;
         }
         // lift a piece ?
-        else if (0 != (u8_squares_count = hint_moves(&s_game, moves_list, pu8_pieces, au8_allowed_squares, sizeof(au8_allowed_squares))))
+        else if (hint_moves(&s_game, moves_list, pu8_pieces, &u8_lifted, &u64_targets))
         {
           #if 0
-            uint8_t piece = au8_prev_pieces[SQUARE_TO_IDX(au8_allowed_squares[0])];
+            uint8_t piece = au8_prev_pieces[SQUARE_TO_IDX(u8_lifted)];
             LOGD("touch %s %s on %c%u", color_to_string(PIECE_COLOR(piece)), piece_to_string(PIECE_TYPE(piece)),
-                ALGEBRAIC(au8_allowed_squares[0]));
+                ALGEBRAIC(u8_lifted));
           #endif
-            ui::leds::setColor(au8_allowed_squares[0], (1 == u8_squares_count) ? ui::leds::LED_RED : ui::leds::LED_ORANGE);
-            for (uint8_t i = 1; i < u8_squares_count; i++) {
-                if (pending_move.from == au8_allowed_squares[0]) {
-                    ui::leds::setColor(au8_allowed_squares[0], ui::leds::LED_GREEN);
-                    ui::leds::setColor(au8_allowed_squares[i], (pending_move.to == au8_allowed_squares[i]) ? ui::leds::LED_GREEN : ui::leds::LED_OFF);
-                    continue;
-                }
-                ui::leds::setColor(au8_allowed_squares[i], ui::leds::LED_GREEN);
-                //LOGD("%u/%u %c%u", i, u8_squares_count - 1, ALGEBRAIC(au8_allowed_squares[i]));
+            if (0 == u64_targets) {
+                ui::leds::setColor(u8_lifted, ui::leds::LED_RED);
+            } else if (pending_move.piece && (pending_move.from == u8_lifted)) {
+                // queued move only
+                ui::leds::setColor(u8_lifted, ui::leds::LED_GREEN);
+                ui::leds::setColors(u64_targets & BB_SQUARE(pending_move.to), ui::leds::LED_GREEN);
+            } else {
+                ui::leds::setColor(u8_lifted, ui::leds::LED_ORANGE);
+                ui::leds::setColors(u64_targets, ui::leds::LED_GREEN);
             }
             ui::leds::update();
         }
@@ -499,8 +729,7 @@ void loop(uint32_t ms_last_changed)
             // is continuation ?
             if (undo_move(&s_game, &move))
             {
-                clear_moves(&moves_list);
-                moves_list = generate_moves(&s_game);
+                moves_list = legal_moves();
                 if (VALID_MOVE())
                 {
                     LOGD("continue move %c%u%c%u", ALGEBRAIC(move.from), ALGEBRAIC(move.to));
@@ -510,7 +739,7 @@ void loop(uint32_t ms_last_changed)
                 else
                 {
                     //LOGW("continuation not found");
-                    show_diff(au8_prev_pieces);
+                    show_diff();
                     ui::leds::update();
                     make_move(&s_game, &move); // redo last
                 }
@@ -518,24 +747,25 @@ void loop(uint32_t ms_last_changed)
             else
             {
                 //LOGW("move not found");
-                show_diff(au8_prev_pieces);
+                show_diff();
                 ui::leds::update();
             }
         }
-
-        clear_moves(&moves_list);
     }
 
+    u64_hot = hot_squares();
     unlock();
+
+    return u64_hot;
 }
 
-const char *generate_fen(const game_st *p_game)
+const char *generate_fen(const game_st *p_game, char *fen_buf)
 {
-    char *fen = ac_fen_buf;
+    char *fen = fen_buf ? fen_buf : ac_fen_buf;
     uint8_t empty = 0;
     uint8_t pos = a8;
 
-    memset(ac_fen_buf, 0, sizeof(ac_fen_buf));
+    memset(fen, 0, FEN_BUFF_LEN);
     while(pos <= h1)
     {
         uint8_t piece = p_game->board[pos];
@@ -569,19 +799,7 @@ const char *generate_fen(const game_st *p_game)
     *fen++ = p_game->stats.turn == WHITE ? 'w' : 'b';
 
     *fen++ = ' ';
-    if ((0 == p_game->stats.castling[WHITE]) && (0 == p_game->stats.castling[BLACK])) {
-        *fen++ = '-';
-    }
-    else {
-        if (p_game->stats.castling[WHITE] & BIT_KSIDE_CASTLE)
-            *fen++ = 'K';
-        if (p_game->stats.castling[WHITE] & BIT_QSIDE_CASTLE)
-            *fen++ = 'Q';
-        if (p_game->stats.castling[BLACK] & BIT_KSIDE_CASTLE)
-            *fen++ = 'k';
-        if (p_game->stats.castling[BLACK] & BIT_QSIDE_CASTLE)
-            *fen++ = 'q';
-    }
+    fen += format_castling(p_game, fen);
 
     *fen++ = ' ';
     if (!p_game->stats.ep_square) {
@@ -597,7 +815,7 @@ const char *generate_fen(const game_st *p_game)
     *fen++ = ' ';
     fen += snprintf(fen, 8, "%u", p_game->stats.move_number);
 
-    return ac_fen_buf;
+    return fen_buf ? fen_buf : ac_fen_buf;
 }
 
 const char *color_to_string(uint8_t b_color)
@@ -624,6 +842,21 @@ const char *piece_to_string(uint8_t u7_type)
     return "UNKNOWN";
 }
 
+const char *result_to_string(uint8_t result)
+{
+    switch (result)
+    {
+    case RESULT_CHECKMATE:          return "mate";
+    case RESULT_STALEMATE:          return "stalemate";
+    case RESULT_INSUFFICIENT:       return "dead pos";
+    case RESULT_SEVENTY_FIVE_MOVES: return "75 moves";
+    case RESULT_FIVEFOLD:           return "5-fold";
+    case RESULT_FIFTY_MOVES:        return "50 moves";
+    case RESULT_THREEFOLD:          return "3-fold";
+    }
+    return "";
+}
+
 const stats_st *get_position(const char **fen /*current position*/, char *move /*last move*/)
 {
     lock();
@@ -655,16 +888,22 @@ bool get_last_move(char *move)
     bool b_status = false;
 
     lock();
-    if (!s_game.history)
+    if (0 == s_game.plies)
     {
         move[0] = move[1] = move[2] = move[3] = 0;
     }
     else
     {
+        uint8_t to = last_move.to;
+        if (b_chess960 && (last_move.flags & BITS_CASTLE) && (0 != s_game.undos)) {
+            // king takes own rook, from the rights before the move
+            const stats_st *stats = &s_game.history[(s_game.plies - 1) & (MAX_HISTORY - 1)].stats;
+            to = (last_move.from & 0xF0) + stats->castling_rooks[PIECE_COLOR(last_move.piece)][(last_move.flags & BIT_KSIDE_CASTLE) ? 1 : 0];
+        }
         move[0] = 'a' + FILE(last_move.from);
         move[1] = '0' + 8 - RANK(last_move.from);
-        move[2] = 'a' + FILE(last_move.to);
-        move[3] = '0' + 8 - RANK(last_move.to);
+        move[2] = 'a' + FILE(to);
+        move[3] = '0' + 8 - RANK(to);
         if (last_move.flags & BIT_PROMOTION) {
             move[4] = PIECE_TYPE(last_move.promoted);
         }
@@ -675,96 +914,294 @@ bool get_last_move(char *move)
     return b_status;
 }
 
-bool get_pgn(const char **pgn)
+pgn_reader_st *open_pgn(uint16_t from_ply, bool b_tags)
 {
-    if (NULL != pgn)
-    {
-        uint16_t total_moves = s_game.stats.move_number;
-        char    *ptr         = ac_pgn_buf;
-        char    *ptr_end     = ptr + sizeof(ac_pgn_buf) - 20;
+    pgn_reader_st *reader = NULL;
 
-        lock();
-        memset(ac_pgn_buf, 0, sizeof(ac_pgn_buf));
-        if (WHITE == s_game.stats.turn) {
-            total_moves--;
-        }
-        for (uint16_t move_idx = 0; move_idx < total_moves; move_idx++)
+    lock();
+    if ((0 != s_pgn.plies) || b_tags)
+    {
+        // replays on its own copy of the game, the record only is shared
+        reader = (pgn_reader_st *)malloc(sizeof(pgn_reader_st));
+        if ((NULL != reader) && !pgn_open(reader, &s_pgn, from_ply, b_tags))
         {
-            ptr += snprintf(ptr, 20, "%u. %s %s ", move_idx + 1,
-                            s_move_stack[move_idx].san_white,
-                            s_move_stack[move_idx].san_black);
-
-            if (ptr > ptr_end)
-                break;
+            free(reader);
+            reader = NULL;
         }
-        //LOGD("pgn(%u) %s", total_moves, ac_pgn_buf);
-        *pgn = total_moves ? ac_pgn_buf : NULL;
+    }
+    unlock();
+
+    return reader;
+}
+
+uint16_t read_pgn(pgn_reader_st *reader, char *buf, uint16_t buf_sz)
+{
+    uint16_t len = 0;
+
+    if ((NULL != reader) && (NULL != buf))
+    {
+        lock();
+        len = pgn_read(reader, buf, buf_sz);
         unlock();
     }
 
-    return true;
+    return len;
+}
+
+void close_pgn(pgn_reader_st *reader)
+{
+    free(reader);
+}
+
+void set_hints(bool b_enable)
+{
+    lock();
+    b_hints = b_enable;
+    if (!b_hints) {
+        search_stop();
+    }
+    notify_position();
+    unlock();
+}
+
+bool set_pgn_tag(uint8_t tag, const char *value)
+{
+    lock();
+    pgn_set_tag(&s_pgn, tag, value);
+    unlock();
+
+    return (tag < PGN_TAG_COUNT);
 }
 
 bool continue_game(const char *expected_fen)
 {
-    char   *tok = strchr(expected_fen, ' ');
-    int     len = tok ? (int)(tok - expected_fen) : 0;
     bool    b_status = false;
 
     lock();
 
-    if (false == b_valid_posision)
+    pgn_clear(&s_pgn);
+    u8_result = RESULT_NONE;
+    u8_claimable = RESULT_NONE;
+    memset(&last_move, 0, sizeof(move_st));
+    memset(&pending_move, 0, sizeof(move_st));
+
+    if (load_fen(&s_game, expected_fen) && validate_position())
+    {
+        // the game position is authoritative, loop() shows the scan differences
+        for (uint8_t idx = 0; idx < sizeof(au8_prev_pieces); idx++) {
+            au8_prev_pieces[idx] = s_game.board[IDX_TO_SQUARE(idx)];
+        }
+        set_prev_pieces(au8_prev_pieces);
+        b_status = (0 == u64_prev_diff);
+        b_valid_posision = true;
+        b_skip_start_fen = true;
+        invalidate_moves();
+        notify_position();
+    }
+    else
     {
-        memcpy(au8_prev_pieces, pu8_pieces, sizeof(au8_prev_pieces));
+        LOGW("invalid fen %s", expected_fen);
+        set_prev_pieces(pu8_pieces);
         b_valid_posision = load_position(pu8_pieces, true);
         b_skip_start_fen = b_valid_posision;
     }
+    LOGD("check fen = %d\r\n%s\r\n%s", b_status, generate_fen(&s_game), expected_fen);
 
-    s_game.stats.turn = (NULL != strstr(expected_fen, " w "));
-    generate_fen(&s_game);
-    b_status = len > 0 ? (0 == strncmp(ac_fen_buf, expected_fen, len)) : (false);
-    LOGD("check %d fen = %d (turn %d)\r\n%s\r\n%s", len, b_status, s_game.stats.turn, ac_fen_buf, expected_fen);
+    unlock();
+    return b_status;
+}
+
+bool queue_move(const char *move)
+{
+    bool b_status = false;
+    move_st queued;
 
-    if (!b_status && !IS_START_FEN(expected_fen))
+    if (move)
     {
-        //LOGD("hmmm previous/queued move is not done yet?");
-        s_game.stats.turn = SWAP_COLOR(s_game.stats.turn); // toggle turn
+        //LOGD("%s", move);
+        lock();
+        if (!parse_move(legal_moves(), move, &queued, &s_game))
+        {
+            LOGW("not a legal move %.8s", move);
+        }
+        else
+        {
+            if ((queued.to != pending_move.to) || (queued.from != pending_move.from))
+            {
+                //LOGD("queue %c%u%c%u", ALGEBRAIC(queued.from), ALGEBRAIC(queued.to));
+                memcpy(&pending_move, &queued, sizeof(move_st));
+            }
+            b_status = true;
+        }
+        unlock();
     }
+    return b_status;
+}
 
+void set_variant(bool b_variant)
+{
+    lock();
+    b_chess960 = b_variant;
     unlock();
+}
+
+bool is_chess960_start(void)
+{
+    bool b_status;
+
+    lock();
+    b_status = b_valid_posision && (0 == s_game.plies) && chess960_position(&s_game);
+    unlock();
+
     return b_status;
 }
 
-bool queue_move(const char *move)
+void engine_init(void)
 {
-    if (move && (strlen(move) > 3))
+    (void)search_init(ENGINE_TT_BITS);
+}
+
+static inline bool book_reply(void)
+{
+    move_st  as_moves[4];
+    uint16_t au16_weights[4];
+    uint32_t u32_total = 0;
+    uint8_t  u8_count = book_moves(&s_game, legal_moves(), as_moves, au16_weights, 4);
+    uint8_t  i;
+
+    for (i = 0; i < u8_count; i++) {
+        u32_total += au16_weights[i];
+    }
+    if (0 == u32_total)
+        return false;
+
+    uint32_t u32_pick = esp_random() % u32_total;
+    for (i = 0; (i < u8_count - 1) && (u32_pick >= au16_weights[i]); i++) {
+        u32_pick -= au16_weights[i];
+    }
+    memcpy(&pending_move, &as_moves[i], sizeof(move_st));
+    LOGD("book reply %c%u%c%u", ALGEBRAIC(pending_move.from), ALGEBRAIC(pending_move.to));
+
+    return true;
+}
+
+bool wait_position(uint32_t *p_seq, uint32_t ms_timeout)
+{
+    uint32_t seq = __atomic_load_n(&u32_position_seq, __ATOMIC_ACQUIRE);
+
+    if ((NULL != position_events) && (*p_seq == seq))
     {
-        //LOGD("%s", move);
-        char from_file = move[0];
-        char from_rank = move[1];
-        char to_file   = move[2];
-        char to_rank   = move[3];
-        int8_t from_sq = ((7 - (from_rank - '1')) << 4) + (from_file - 'a');
-        int8_t to_sq   = ((7 - (to_rank - '1')) << 4) + (to_file - 'a');
-        if ((from_sq < a8) || (from_sq > h1) || (to_sq < a8) || (to_sq > h1))
+        (void)xEventGroupClearBits(position_events, POSITION_CHANGED_BIT);
+        if (*p_seq == (seq = __atomic_load_n(&u32_position_seq, __ATOMIC_ACQUIRE))) // not changed meanwhile
+        {
+            (void)xEventGroupWaitBits(position_events, POSITION_CHANGED_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(ms_timeout));
+            seq = __atomic_load_n(&u32_position_seq, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    bool b_changed = (*p_seq != seq);
+    *p_seq = seq;
+    return b_changed;
+}
+
+void engine_loop(void)
+{
+    static uint32_t u32_seq = 0;
+    search_result_st result;
+    uint32_t u32_budget = 0;
+    uint8_t  u8_depth = 0;
+    bool     b_reply = false;
+
+    if (NULL == mtx)
+        return; // board task not started yet
+
+    lock();
+    // claimable draws are not a result, the engine keeps replying
+    if (!b_valid_posision || (RESULT_NONE != u8_result) || (0 != pending_move.piece))
+    {
+        // nothing to play or analyse
+    }
+    else if (u8_engine_level && (u8_engine_color == s_game.stats.turn))
+    {
+        const engine_level_st *level = &AS_ENGINE_LEVELS[u8_engine_level - 1];
+        if (u64_reply_key == s_game.stats.key)
         {
-            LOGW("invalid coord %d %d", from_sq, to_sq);
+            // already played, waiting for the move on the board
+        }
+        else if (level->b_book && book_reply())
+        {
+            u64_reply_key = s_game.stats.key;
         }
         else
         {
-            if ((to_sq != pending_move.to) || (from_sq != pending_move.from))
-            {
-                //LOGD("queue %c%u%c%u", ALGEBRAIC(from_sq), ALGEBRAIC(to_sq));
-                lock();
-                pending_move.piece = s_game.board[from_sq];
-                pending_move.from = from_sq;
-                pending_move.to   = to_sq;
-                unlock();
+            memcpy(&s_engine_game, &s_game, sizeof(game_st));
+            u32_budget = level->ms_budget;
+            u8_depth   = level->depth;
+            b_reply    = true;
+        }
+    }
+    // once per position, when the book has no move for it
+    else if (b_hints && (u64_analysis_key != s_game.stats.key) && (u64_book_key == s_game.stats.key) && (0 == u8_book_count))
+    {
+        memcpy(&s_engine_game, &s_game, sizeof(game_st));
+        u32_budget = ENGINE_BUDGET_MS;
+        u8_depth   = SEARCH_MAX_PLY;
+    }
+    unlock();
+
+    if (0 == u8_depth)
+    {
+        (void)wait_position(&u32_seq, ENGINE_IDLE_MS); // idle until something changes
+    }
+    else if (search(&s_engine_game, u32_budget, u8_depth, &result))
+    {
+        lock();
+        if (s_engine_game.stats.key != s_game.stats.key)
+        {
+            // moved meanwhile
+        }
+        else if (b_reply)
+        {
+            // shown like a queued online move, until made on the board
+            if (u8_engine_level && (0 == pending_move.piece)) {
+                memcpy(&pending_move, &result.best, sizeof(move_st));
+                u64_reply_key = s_game.stats.key;
             }
-            return true;
         }
+        else if (b_hints)
+        {
+            memcpy(&s_analysis, &result, sizeof(search_result_st));
+            u64_analysis_key = s_game.stats.key;
+            memset(ac_analysis_san, 0, sizeof(ac_analysis_san));
+            move_to_san(legal_moves(), &result.best, ac_analysis_san, sizeof(ac_analysis_san) - 1);
+            b_analysis_shown = false;
+        }
+        unlock();
     }
-    return false;
+}
+
+void set_opponent(uint8_t u8_level, uint8_t b_color)
+{
+    lock();
+    u8_engine_level = (u8_level < ENGINE_LEVELS) ? u8_level : ENGINE_LEVELS;
+    u8_engine_color = b_color;
+    u64_reply_key   = 0;
+    if (0 == u8_engine_level) {
+        search_stop();
+    }
+    notify_position();
+    unlock();
+}
+
+uint8_t get_result(void)
+{
+    uint8_t u8_status;
+
+    lock();
+    u8_status = u8_result;
+    unlock();
+
+    return u8_status;
 }
 
 } // namespace chess
@@ -22,19 +22,46 @@ typedef enum {
     WHITE   = 1
 } color_et;
 
-/* 8-bit piece */
-#define PIECE_TYPE(u8_piece)            (tolower(u8_piece))
-#define PIECE_COLOR(u8_piece)           (isupper(u8_piece))
-#define PIECE_INT(u7_type)              (PAWN==(u7_type) ? 1 : (KNIGHT==(u7_type) ? 2 : (BISHOP==(u7_type) ? 3 : (ROOK==(u7_type) ? 4 : (QUEEN==(u7_type) ? 5 : (KING==(u7_type) ? 6 : 0))))))
+/* 8-bit piece lookups, indexed by the raw character */
+typedef struct {
+    uint8_t type[256];      // piece_et, _NONE if not a piece
+    uint8_t color[256];     // color_et, WHITE for upper case
+    uint8_t index[256];     // piece_et to 1 (pawn) .. 6 (king), 0 if not a piece type
+} piece_tables_st;
+
+constexpr piece_tables_st piece_tables(void)
+{
+    constexpr uint8_t TYPES[] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+    piece_tables_st tables = {};
+
+    for (uint16_t ch = 'A'; ch <= 'Z'; ch++) {
+        tables.color[ch] = WHITE;
+    }
+    for (uint8_t i = 0; i < sizeof(TYPES); i++) {
+        tables.type[TYPES[i]] = TYPES[i];
+        tables.type[TYPES[i] - 'a' + 'A'] = TYPES[i];
+        tables.index[TYPES[i]] = i + 1;
+    }
+
+    return tables;
+}
+
+constexpr piece_tables_st PIECE_TABLES = piece_tables();
+
+#define PIECE_TYPE(u8_piece)            (chess::PIECE_TABLES.type[(uint8_t)(u8_piece)])
+#define PIECE_COLOR(u8_piece)           (chess::PIECE_TABLES.color[(uint8_t)(u8_piece)])
+#define PIECE_INT(u7_type)              (chess::PIECE_TABLES.index[(uint8_t)(u7_type)])
 #define SWAP_COLOR(color)               ((color) == WHITE ? BLACK : WHITE)
 #define MAKE_PIECE(b_color, u7_type)    ((uint8_t)(b_color ? toupper(u7_type) : tolower(u7_type)))
-#define VALID_PIECE(u7_type)            ((chess::PAWN==u7_type) || (chess::KNIGHT==u7_type) || (chess::BISHOP==u7_type) || \
-                                         (chess::ROOK==u7_type) || (chess::QUEEN==u7_type)  || (chess::KING==u7_type))
+#define VALID_PIECE(u7_type)            (0 != PIECE_INT(u7_type))
+
+static_assert((PIECE_TYPE('Q') == QUEEN) && (PIECE_COLOR('Q') == WHITE) && (PIECE_COLOR('q') == BLACK), "piece tables");
+static_assert((PIECE_INT(PAWN) == 1) && (PIECE_INT(KING) == 6) && (PIECE_INT('K') == 0) && (PIECE_TYPE('x') == _NONE), "piece tables");
 
 extern const char *START_FEN;
 #define IS_START_FEN(fen)               ((fen == chess::START_FEN) || (0 == strncmp(fen, chess::START_FEN, 43)))
 #define FEN_BUFF_LEN                    (80)
-#define PGN_BUFF_LEN                    (2048)
+#define MAX_HISTORY                     (256) // plies (power of 2), repetitions look back 150 at most (75-move rule)
 
 typedef enum {
     a8 =   0, b8 =   1, c8 =   2, d8 =   3, e8 =   4, f8 =   5, g8 =   6, h8 =   7,
@@ -50,6 +77,12 @@ typedef enum {
 #define SQUARE_TO_IDX(sq)               (((7 - ((sq)>>4)) << 3) + ((sq) & 0xF))
 #define IDX_TO_SQUARE(idx)              (((7 - ((idx)>>3)) << 4) + ((idx) & 0x7))
 
+#ifndef BITBOARDS
+#define BITBOARDS                       (1) // mirror board[] as per-piece bitboards in game_st
+#endif
+#define BB_SQUARE(sq)                   (1ULL << SQUARE_TO_IDX(sq)) // bit index = scan index (a1 = 0)
+#define BB_INDEX(u7_type)               (PIECE_INT(u7_type) - 1)    // pawn = 0 .. king = 5
+
 #define RANK(sq)                        ((sq) >> 4) // row
 #define FILE(sq)                        ((sq) & 0xF) // column
 #define ALGEBRAIC(sq)                   FILE(sq) + 'a', 8 - RANK(sq)
@@ -65,6 +98,8 @@ typedef enum {
     BIT_QSIDE_CASTLE = (1<<6)
 } movemask_et;
 
+#define BITS_CASTLE                     (BIT_KSIDE_CASTLE | BIT_QSIDE_CASTLE)
+
 typedef enum {
     RANK_1  = 7,
     RANK_2  = 6,
@@ -76,8 +111,7 @@ typedef enum {
     RANK_8  = 0
 } rank_et;
 
-typedef struct move {
-    struct move *next;
+typedef struct {
     uint8_t from;
     uint8_t to;
     uint8_t piece;
@@ -86,7 +120,32 @@ typedef struct move {
     uint8_t promoted;
 } move_st;
 
+#define MAX_MOVES                       (218) // most legal moves of any reachable position
+
+typedef struct {
+    uint8_t  count;
+    move_st  moves[MAX_MOVES];
+    uint64_t origins;       // BB_SQUARE() of the squares with legal moves
+    uint64_t targets[64];   // per SQUARE_TO_IDX() origin, valid for origins only
+} move_list_st;
+
+#define MOVE_TARGETS(list, sq)          ((((list)->origins >> SQUARE_TO_IDX(sq)) & 1) ? (list)->targets[SQUARE_TO_IDX(sq)] : 0)
+
+typedef enum {
+    RESULT_NONE = 0,            // game goes on
+    RESULT_CHECKMATE,
+    RESULT_STALEMATE,
+    RESULT_INSUFFICIENT,        // neither side can mate
+    RESULT_SEVENTY_FIVE_MOVES,  // 150 plies without capture or pawn move
+    RESULT_FIVEFOLD,
+    RESULT_FIFTY_MOVES,         // claimable
+    RESULT_THREEFOLD            // claimable
+} result_et;
+
+#define MOVES_FOREACH(list, elt)        for ((elt) = (list)->moves; (elt) < ((list)->moves + (list)->count); (elt)++)
+
 typedef struct {
+    uint64_t key;           // zobrist hash of the position
     uint8_t  turn;          // which color to move
     uint8_t  ep_square;     // en-pasant square
     uint8_t  castling[2];   // castling rights
@@ -94,49 +153,155 @@ typedef struct {
     uint16_t move_number;
     uint8_t  kings[2];      // kings position
     uint8_t  valid;         // (bool) false = busy checking
+    uint8_t  castling_rooks[2][2]; // rook files per color, queen then king side (chess960)
 } stats_st;
 
-typedef struct record {
-    struct record *next;
+typedef struct {
     move_st  move;
-    stats_st stats;
+    stats_st stats;         // before the move
 } record_st;
 
 typedef struct {
     uint8_t    board[128];  // position
     stats_st   stats;
-    record_st *history;
+    uint8_t    pieces[2][16];     // squares occupied per color
+    uint8_t    piece_count[2];
+    uint8_t    piece_index[128];  // square to pieces[color][] slot
+#if BITBOARDS
+    uint64_t   bitboards[2][6];   // per color and BB_INDEX() piece type
+    uint64_t   occupied[2];       // per color
+#endif
+    uint16_t   plies;       // half-moves made since init_game()
+    uint16_t   undos;       // records available for undo_move()
+    record_st  history[MAX_HISTORY]; // undo ring, oldest records get overwritten
 } game_st;
 
+/* game record, moves packed to 16 bits in chunks, SAN rendered by replay */
+#define PGN_CHUNK_PLIES                 (64)
+#define PGN_TAG_LEN                     (40)
+#define PGN_TOKEN_LEN                   (FEN_BUFF_LEN + 40) // longest rendered piece, the FEN tag
+
+typedef enum {
+    PGN_TAG_EVENT,
+    PGN_TAG_SITE,
+    PGN_TAG_DATE,
+    PGN_TAG_ROUND,
+    PGN_TAG_WHITE,
+    PGN_TAG_BLACK,
+    PGN_TAG_COUNT               // Result is from pgn_st.result
+} pgn_tag_et;
+
+typedef struct pgn_chunk_s {
+    struct pgn_chunk_s *next;
+    uint16_t      moves[PGN_CHUNK_PLIES];
+} pgn_chunk_st;
+
+typedef struct {
+    uint8_t       board[64];    // start position, scan order
+    stats_st      stats;
+    char          tags[PGN_TAG_COUNT][PGN_TAG_LEN]; // "?" if empty
+    uint8_t       result;       // result_et after the last ply
+    uint16_t      plies;
+    pgn_chunk_st *chunks;       // allocated as the game grows
+} pgn_st;
+
+typedef struct {
+    const pgn_st *pgn;
+    game_st       game;         // replayed position
+    move_list_st  list;         // legal moves of the replayed position
+    uint16_t      ply;          // next ply to render
+    uint8_t       step;
+    bool          b_tags;
+    bool          b_first;      // first move rendered, numbered if black
+    uint8_t       pending;      // text not read yet
+    char          text[PGN_TOKEN_LEN];
+} pgn_reader_st;
+
+/* engine */
+#define SEARCH_MAX_PLY                  (32) // including quiescence
+
+static_assert((150 + SEARCH_MAX_PLY <= MAX_HISTORY) && (0 == (MAX_HISTORY & (MAX_HISTORY - 1))), "history ring");
+#define SEARCH_MATE                     (30000) // less the plies to mate
+#define ENGINE_LEVELS                   (8)     // offline opponent strength, 1 .. 8
+
+typedef struct {
+    move_st  best;          // piece 0 if no move
+    int16_t  score;         // centipawns for the side to move
+    uint8_t  depth;         // last complete iteration
+    uint32_t nodes;
+    uint32_t ms;
+} search_result_st;
+
 
 void init(void);
-void loop(uint32_t ms_last_changed);
+uint64_t loop(uint32_t ms_last_changed); // squares to scan first (BB_SQUARE bits)
 
-const char *generate_fen(const game_st *p_game);
+const char *generate_fen(const game_st *p_game, char *fen_buf=nullptr /*FEN_BUFF_LEN, else shared*/);
+bool parse_castling(game_st *p_game, const char *field /*KQkq, X-FEN or Shredder-FEN*/); // board and kings set, rights unchanged if not valid, key not updated
+uint8_t format_castling(const game_st *p_game, char *buf /*5*/); // X-FEN, file letters for inner rooks only
+bool chess960_position(const game_st *p_game); // start position of chess960, the standard one included
+bool load_fen(game_st *p_game, const char *fen); // strict, counters optional, p_game reset even if not valid
 
-bool attacked(const uint8_t *board, uint8_t color, uint8_t square);
-#define KING_ATTACKED(game, color)  attacked((game)->board, SWAP_COLOR((color)),  (game)->stats.kings[(color)])
+bool attacked(const game_st *p_game, uint8_t color, uint8_t square);
+#define KING_ATTACKED(game, color)  attacked((game), SWAP_COLOR((color)),  (game)->stats.kings[(color)])
 #define IN_CHECK(game)              KING_ATTACKED((game), (game)->stats.turn)
 
 void init_game(game_st *p_game);
+bool index_position(game_st *p_game); // rebuild piece lists and key after editing board[] or stats
+uint64_t position_key(const game_st *p_game, const uint64_t *keys=nullptr /*781 polyglot style, own if null*/); // full (non-incremental) zobrist key
 void make_move(game_st *p_game, const move_st *move);
 bool undo_move(game_st *p_game, move_st *last=nullptr);
-move_st *generate_moves(game_st *p_game);
-bool move_to_san(move_st *list /*moves list*/, const move_st *p_move /*convert to SAN*/, char *san_buf, uint8_t buf_sz);
-bool find_move(game_st *p_game /*board*/, move_st *list /*moves list*/, const uint8_t *scan /*input or desired raw position*/, move_st *p_move /*found move*/);
-uint8_t hint_moves(game_st *p_game /*board*/, move_st *list /*moves list*/, const uint8_t *scan, uint8_t *squares_buf, uint8_t max_count);
-void clear_moves(move_st **plist);
+uint8_t generate_moves(game_st *p_game, move_list_st *list /*output*/);
+bool move_to_san(const move_list_st *list /*moves list*/, const move_st *p_move /*convert to SAN*/, char *san_buf, uint8_t buf_sz, game_st *p_game=nullptr /*adds +/# if given*/);
+bool parse_move(const move_list_st *list /*moves list*/, const char *text /*SAN or UCI*/, move_st *p_move /*found move*/, const game_st *p_game=nullptr /*uci king takes rook castling if given*/);
+bool find_move(game_st *p_game /*board*/, const move_list_st *list /*moves list*/, const uint8_t *scan /*input or desired raw position*/, move_st *p_move /*found move*/);
+bool hint_moves(game_st *p_game /*board*/, const move_list_st *list /*moves list*/, const uint8_t *scan, uint8_t *p_from /*lifted piece*/, uint64_t *p_targets /*BB_SQUARE() bits*/);
+uint32_t perft(game_st *p_game, uint8_t depth); // leaf nodes count, for move generator checks
+uint8_t repetitions(const game_st *p_game); // occurrences of the current position, up to 5
+bool insufficient_material(const game_st *p_game);
+uint8_t game_result(const game_st *p_game, uint8_t move_count /*legal moves*/); // result_et, final results only
+uint8_t claimable_draw(const game_st *p_game); // RESULT_FIFTY_MOVES, RESULT_THREEFOLD or RESULT_NONE
+
+void pgn_init(pgn_st *pgn, const game_st *p_game); // new record from the position, keeps the tags
+void pgn_clear(pgn_st *pgn);
+bool pgn_append(pgn_st *pgn, const move_st *move);
+void pgn_truncate(pgn_st *pgn, uint16_t plies);
+void pgn_set_tag(pgn_st *pgn, uint8_t tag, const char *value);
+bool pgn_open(pgn_reader_st *reader, const pgn_st *pgn, uint16_t from_ply /*movetext only*/, bool b_tags);
+uint16_t pgn_read(pgn_reader_st *reader, char *buf, uint16_t buf_sz /*>= PGN_TOKEN_LEN*/); // whole tokens, 0 when done
+
+bool book_open(const char *name /*partition label, file on the host*/); // polyglot book image
+void book_close(void);
+uint64_t book_key(const game_st *p_game); // polyglot key, 0 without a book
+uint8_t book_moves(const game_st *p_game, const move_list_st *list /*legal moves*/, move_st *moves /*output*/, uint16_t *weights, uint8_t max_count);
+
+bool search_init(uint8_t tt_bits); // allocates the search arena once, up to 2^tt_bits table entries
+int16_t evaluate(const game_st *p_game); // material and piece-square tables, for the side to move
+bool search(game_st *p_game, uint32_t ms_budget, uint8_t max_depth, search_result_st *result); // iterative deepening
+void search_stop(void); // from another task, the last complete iteration stands
 
 const char *color_to_string(uint8_t b_color);
 const char *piece_to_string(uint8_t u7_type);
+const char *result_to_string(uint8_t result);
 
 // api's
 const stats_st *get_position(const char **fen /*current position*/, char *move /*last uci move*/);
 bool get_position(const char **fen);
 bool get_last_move(char *move /*uci*/);
-bool get_pgn(const char **pgn);
-bool continue_game(const char *expected_fen); // continue game from position
+bool wait_position(uint32_t *p_seq /*last seen, updated*/, uint32_t ms_timeout); // blocks until the position changes, false on timeout
+pgn_reader_st *open_pgn(uint16_t from_ply, bool b_tags); // NULL if no moves yet
+uint16_t read_pgn(pgn_reader_st *reader, char *buf, uint16_t buf_sz);
+void close_pgn(pgn_reader_st *reader);
+bool set_pgn_tag(uint8_t tag, const char *value);
+void set_hints(bool b_enable); // book moves, off while playing online
+bool continue_game(const char *expected_fen); // continue game from position, true if the board matches it
+void set_variant(bool b_chess960); // castling sent as king takes rook
+bool is_chess960_start(void); // board set up as a chess960 start position
 bool queue_move(const char *move);
+void engine_init(void);
+void engine_loop(void); // plays the engine moves or analyses the position for hints, low priority task
+void set_opponent(uint8_t u8_level /*1 .. ENGINE_LEVELS, 0 = none*/, uint8_t b_color /*engine side*/);
+uint8_t get_result(void); // result_et of the current position, RESULT_NONE while the game goes on
 
 
 } // namespace chess
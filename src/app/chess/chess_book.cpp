@@ -0,0 +1,223 @@
+#include <stdlib.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_partition.h>
+#endif
+
+#include "chess.h"
+#include "chess_priv.h"
+
+
+namespace chess
+{
+
+/* book image, big endian: magic, entry count, the 781 polyglot Random64 keys,
+   then the polyglot .bin entries sorted by key (key, move, weight, learn) */
+#define BOOK_MAGIC                      (0x50474B31) // "PGK1"
+#define BOOK_ENTRIES_OFFSET             (8 + 8 * ZOBRIST_KEYS)
+#define BOOK_ENTRY_SIZE                 (16)
+#define BOOK_PAGE_ENTRIES               (16)
+#define BOOK_PAGES                      (4) // cached pages, least recently used is replaced
+
+typedef struct {
+    uint32_t index;             // first entry
+    uint32_t used;              // last access
+    bool     b_valid;
+    uint8_t  data[BOOK_PAGE_ENTRIES * BOOK_ENTRY_SIZE];
+} book_page_st;
+
+static struct {
+#if defined(ESP_PLATFORM)
+    const esp_partition_t *partition;
+#else
+    FILE                  *file;
+#endif
+    uint32_t      count;        // entries, 0 if no book
+    uint64_t     *keys;         // ZOBRIST_KEYS
+    uint32_t      u32_tick;
+    uint32_t      u32_reads;    // flash reads, for instrumentation
+    book_page_st  pages[BOOK_PAGES];
+} s_book;
+
+static inline uint64_t be64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static inline uint16_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static bool book_read(uint32_t offset, void *buf, uint32_t size)
+{
+    s_book.u32_reads++;
+#if defined(ESP_PLATFORM)
+    return (ESP_OK == esp_partition_read(s_book.partition, offset, buf, size));
+#else
+    return (0 == fseek(s_book.file, offset, SEEK_SET)) && (size == fread(buf, 1, size, s_book.file));
+#endif
+}
+
+static const uint8_t *book_entry(uint32_t index)
+{
+    uint32_t first = index - (index % BOOK_PAGE_ENTRIES);
+    book_page_st *page = &s_book.pages[0];
+
+    s_book.u32_tick++;
+    for (uint8_t i = 0; i < BOOK_PAGES; i++) {
+        book_page_st *elt = &s_book.pages[i];
+        if (elt->b_valid && (elt->index == first)) {
+            page = elt;
+            break;
+        }
+        if (!elt->b_valid || (elt->used < page->used)) {
+            page = elt;
+        }
+    }
+
+    if (!page->b_valid || (page->index != first)) {
+        uint32_t entries = s_book.count - first;
+        if (entries > BOOK_PAGE_ENTRIES)
+            entries = BOOK_PAGE_ENTRIES;
+        page->b_valid = book_read(BOOK_ENTRIES_OFFSET + first * BOOK_ENTRY_SIZE, page->data, entries * BOOK_ENTRY_SIZE);
+        page->index = first;
+        if (!page->b_valid)
+            return NULL;
+    }
+
+    page->used = s_book.u32_tick;
+    return &page->data[(index - first) * BOOK_ENTRY_SIZE];
+}
+
+bool book_open(const char *name)
+{
+    uint8_t header[8];
+
+    book_close();
+
+#if defined(ESP_PLATFORM)
+    s_book.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+    if (NULL == s_book.partition)
+        return false;
+#else
+    if (NULL == (s_book.file = fopen(name, "rb")))
+        return false;
+#endif
+
+    if (!book_read(0, header, sizeof(header)) || (BOOK_MAGIC != (uint32_t)(be64(header) >> 32))) {
+        LOGW("no book on %s", name);
+        book_close();
+        return false;
+    }
+
+    s_book.keys = (uint64_t *)malloc(8 * ZOBRIST_KEYS);
+    if ((NULL == s_book.keys) || !book_read(8, s_book.keys, 8 * ZOBRIST_KEYS)) {
+        book_close();
+        return false;
+    }
+    for (uint16_t i = 0; i < ZOBRIST_KEYS; i++) {
+        s_book.keys[i] = be64((const uint8_t *)&s_book.keys[i]);
+    }
+
+    s_book.count = (uint32_t)be64(header);
+    LOGI("book %s: %lu entries", name, (unsigned long)s_book.count);
+
+    return true;
+}
+
+void book_close(void)
+{
+#if defined(ESP_PLATFORM)
+    s_book.partition = NULL;
+#else
+    if (NULL != s_book.file)
+        fclose(s_book.file);
+#endif
+    free(s_book.keys);
+    memset(&s_book, 0, sizeof(s_book));
+}
+
+uint64_t book_key(const game_st *p_game)
+{
+    return s_book.keys ? position_key(p_game, s_book.keys) : 0;
+}
+
+uint8_t book_moves(const game_st *p_game, const move_list_st *list, move_st *moves, uint16_t *weights, uint8_t max_count)
+{
+    static const uint8_t PROMOTIONS[] = { _NONE, KNIGHT, BISHOP, ROOK, QUEEN };
+    uint8_t count = 0;
+
+    if ((0 == s_book.count) || (NULL == p_game) || (NULL == list) || (NULL == moves))
+        return 0;
+
+    uint64_t key = book_key(p_game);
+    uint32_t reads = s_book.u32_reads;
+    uint32_t lo = 0;
+    uint32_t hi = s_book.count;
+    const uint8_t *entry;
+
+    /* first entry of the key */
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if (NULL == (entry = book_entry(mid)))
+            return 0;
+        if (be64(entry) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < s_book.count; lo++)
+    {
+        if ((NULL == (entry = book_entry(lo))) || (be64(entry) != key))
+            break;
+
+        /* move bits: to file, to row, from file, from row, promotion */
+        uint16_t move   = be16(entry + 8);
+        uint16_t weight = be16(entry + 10);
+        uint8_t  from   = ((7 - ((move >> 9) & 7)) << 4) + ((move >> 6) & 7);
+        uint8_t  to     = ((7 - ((move >> 3) & 7)) << 4) + (move & 7);
+        uint8_t  promo  = (move >> 12) & 7;
+
+        // castling is encoded as king takes own rook
+        bool b_castle = (MAKE_PIECE(p_game->stats.turn, KING) == p_game->board[from]) &&
+                        (MAKE_PIECE(p_game->stats.turn, ROOK) == p_game->board[to]);
+
+        const move_st *elt;
+        MOVES_FOREACH(list, elt) {
+            if (b_castle ? ((elt->flags & BITS_CASTLE) && (CASTLING_ROOK(&p_game->stats, p_game->stats.turn, CASTLE_SIDE(elt->flags)) == to))
+                         : ((elt->from == from) && (elt->to == to) && !(elt->flags & BITS_CASTLE)))
+                break;
+        }
+        if ((elt == (list->moves + list->count)) || (0 == weight) || (promo >= sizeof(PROMOTIONS)))
+            continue;
+
+        /* by weight, heaviest first */
+        uint8_t n = (count < max_count) ? count++ : count;
+        while ((n > 0) && (NULL != weights) && (weights[n - 1] < weight)) {
+            if (n < max_count) {
+                moves[n] = moves[n - 1];
+                weights[n] = weights[n - 1];
+            }
+            n--;
+        }
+        if (n < max_count) {
+            moves[n] = *elt;
+            if (elt->flags & BIT_PROMOTION)
+                moves[n].promoted = PROMOTIONS[promo];
+            if (NULL != weights)
+                weights[n] = weight;
+        }
+    }
+
+    LOGD("book %016llx: %u moves, %lu reads", (unsigned long long)key, count, (unsigned long)(s_book.u32_reads - reads));
+    return count;
+}
+
+} // namespace chess
@@ -1,7 +1,3 @@
-
-#include <utlist/utlist.h>
-
-#include "globals.h"
 #include "chess.h"
 #include "chess_priv.h"
 
@@ -9,24 +5,81 @@
 namespace chess
 {
 
+#if CHESS_COUNTERS
+counters_st bench_counters;
+#endif
+
+#if BITBOARDS
+static inline uint64_t ray_attacks(uint8_t ray, uint8_t idx, uint64_t occupied)
+{
+    uint64_t attacks  = BB_TABLES.rays[ray][idx];
+    uint64_t blockers = attacks & occupied;
+
+    if (0 != blockers) {
+        /* nearest blocker, cut the ray behind it */
+        uint8_t blocker = (ray < BB_SOUTH) ? __builtin_ctzll(blockers) : (63 - __builtin_clzll(blockers));
+        attacks ^= BB_TABLES.rays[ray][blocker];
+    }
+
+    return attacks;
+}
+
+static inline uint64_t bishop_attacks(uint8_t idx, uint64_t occupied)
+{
+    return ray_attacks(BB_NORTH_EAST, idx, occupied) | ray_attacks(BB_NORTH_WEST, idx, occupied) |
+           ray_attacks(BB_SOUTH_WEST, idx, occupied) | ray_attacks(BB_SOUTH_EAST, idx, occupied);
+}
+
+static inline uint64_t rook_attacks(uint8_t idx, uint64_t occupied)
+{
+    return ray_attacks(BB_NORTH, idx, occupied) | ray_attacks(BB_EAST, idx, occupied) |
+           ray_attacks(BB_SOUTH, idx, occupied) | ray_attacks(BB_WEST, idx, occupied);
+}
 
-bool attacked(const uint8_t *board, uint8_t color, uint8_t square)
+static inline uint64_t piece_attacks(uint8_t type, uint8_t idx, uint64_t occupied)
 {
-    for (uint8_t i = a8; i <= h1; i++)
+    switch (type)
     {
-        if (FILE(i) > 7)
-            continue;
+    case KNIGHT:    return BB_TABLES.knight[idx];
+    case BISHOP:    return bishop_attacks(idx, occupied);
+    case ROOK:      return rook_attacks(idx, occupied);
+    case QUEEN:     return bishop_attacks(idx, occupied) | rook_attacks(idx, occupied);
+    case KING:      return BB_TABLES.king[idx];
+    }
+    return 0;
+}
+
+bool attacked(const game_st *p_game, uint8_t color, uint8_t square)
+{
+    const uint64_t *pieces = p_game->bitboards[color];
+    uint64_t occupied = p_game->occupied[WHITE] | p_game->occupied[BLACK];
+    uint8_t  idx = SQUARE_TO_IDX(square);
+
+    COUNT(attacked);
+
+    return (BB_TABLES.pawn[SWAP_COLOR(color)][idx] & pieces[BB_INDEX(PAWN)]) ||
+           (BB_TABLES.knight[idx] & pieces[BB_INDEX(KNIGHT)]) ||
+           (BB_TABLES.king[idx] & pieces[BB_INDEX(KING)]) ||
+           (bishop_attacks(idx, occupied) & (pieces[BB_INDEX(BISHOP)] | pieces[BB_INDEX(QUEEN)])) ||
+           (rook_attacks(idx, occupied) & (pieces[BB_INDEX(ROOK)] | pieces[BB_INDEX(QUEEN)]));
+}
+#else
+bool attacked(const game_st *p_game, uint8_t color, uint8_t square)
+{
+    const uint8_t *board = p_game->board;
+
+    COUNT(attacked);
 
+    for (uint8_t n = 0; n < p_game->piece_count[color]; n++)
+    {
+        uint8_t i = p_game->pieces[color][n];
         uint8_t piece = board[i];
-        /* if empty square or wrong color */
-        if ((0 == piece) || (PIECE_COLOR(piece) != color))
-            continue;
 
         int16_t difference = i - square;
         int16_t index = difference + h1;
         uint8_t type  = PIECE_TYPE(piece);
 
-        if (index < 0 || index >= sizeof(ATTACKS))
+        if (index < 0 || index >= (int16_t)sizeof(ATTACKS))
             continue;
 
         if (ATTACKS[index] & (1 << SHIFTS[PIECE_INT(type)])) {
@@ -60,99 +113,498 @@ bool attacked(const uint8_t *board, uint8_t color, uint8_t square)
 
     return false;
 }
+#endif
+
+/* "to" squares already added for the current "from" square (0x88 index bits) */
+typedef struct {
+    uint8_t  from;
+    uint32_t au32_to[128 / 32];
+} seen_st;
 
-static int compare_moves(move_st *a, move_st *b)
+static inline bool add_move(game_st *p_game, move_list_st *list, seen_st *seen, uint8_t from, uint8_t to, uint8_t flags)
 {
-    if (!a || !b) return -1;
-    if (a->from  != b->from)  return -1;
-    if (a->to    != b->to)    return -1;
-    return 0; // same "from" and "to"
+    /* duplicates can only come from the same origin, which is generated contiguously,
+       castling may share its squares with a king move (chess960) */
+    if (seen->from != from) {
+        seen->from = from;
+        memset(seen->au32_to, 0, sizeof(seen->au32_to));
+    } else if (!(flags & BITS_CASTLE) && (seen->au32_to[to >> 5] & (1UL << (to & 31)))) {
+        //LOGD("already existing %02x from %d to %d", p_game->board[from], from, to);
+        return true;
+    }
+
+    if (list->count >= MAX_MOVES) {
+        LOGW("%s() failed", __func__);
+        return false;
+    }
+
+    seen->au32_to[to >> 5] |= (1UL << (to & 31));
+
+    move_st *elt = &list->moves[list->count++];
+    elt->from  = from;
+    elt->to    = to;
+    elt->piece = p_game->board[from];
+    elt->flags = flags;
+    elt->captured = p_game->board[to];
+    elt->promoted = 0;
+    if (flags & BITS_CASTLE) {
+        elt->captured = 0; // ignore own rook
+    } else if (flags & BIT_EP_CAPTURE) {
+        elt->captured = MAKE_PIECE(SWAP_COLOR(p_game->stats.turn), PAWN);
+    }
+
+    if ((PAWN == PIECE_TYPE(elt->piece)) && ((0 == RANK(elt->to)) || (7 == RANK(elt->to)))) {
+        elt->flags |= BIT_PROMOTION;
+    }
+
+    return true;
 }
 
-static inline bool add_move(game_st *p_game, move_st **plist, uint8_t from, uint8_t to, uint8_t flags)
+static inline void push(game_st *p_game, const move_st *move)
 {
-    move_st move;
-    move.from  = from;
-    move.to    = to;
-    move.piece = p_game->board[from];
-    move.flags = flags;
-    move.captured = p_game->board[to];
-    if (flags & BIT_KSIDE_CASTLE) {
-        move.captured = 0; // ignore own rook
-    } else if (flags & BIT_EP_CAPTURE) {
-        move.captured = MAKE_PIECE(SWAP_COLOR(p_game->stats.turn), PAWN);
+    record_st *record = &p_game->history[p_game->plies & (MAX_HISTORY - 1)];
+    memcpy(&record->move, move, sizeof(move_st));
+    memcpy(&record->stats, &p_game->stats, sizeof(stats_st));
+    p_game->plies++;
+    if (p_game->undos < MAX_HISTORY) {
+        p_game->undos++;
     }
+}
 
-    if ((PAWN == PIECE_TYPE(move.piece)) && ((0 == RANK(move.to)) || (7 == RANK(move.to)))) {
-        move.flags |= BIT_PROMOTION;
+static inline uint64_t castling_key(const stats_st *stats, const uint64_t *keys=ZOBRIST.keys)
+{
+    uint64_t key = 0;
+    if (stats->castling[WHITE] & BIT_KSIDE_CASTLE) key ^= keys[ZOBRIST_CASTLING + 0];
+    if (stats->castling[WHITE] & BIT_QSIDE_CASTLE) key ^= keys[ZOBRIST_CASTLING + 1];
+    if (stats->castling[BLACK] & BIT_KSIDE_CASTLE) key ^= keys[ZOBRIST_CASTLING + 2];
+    if (stats->castling[BLACK] & BIT_QSIDE_CASTLE) key ^= keys[ZOBRIST_CASTLING + 3];
+    return key;
+}
+
+/* en passant file counts only if a pawn of the side to move can capture */
+static inline uint64_t ep_key(const game_st *p_game, const uint64_t *keys=ZOBRIST.keys)
+{
+    uint8_t ep = p_game->stats.ep_square;
+    uint8_t us = p_game->stats.turn;
+
+    if (0 != ep) {
+        for (uint8_t j = 2; j < 4; j++) {
+            uint8_t square = ep - PIECE_OFFSETS[us][j];
+            if (!(square & 0x88) && (MAKE_PIECE(us, PAWN) == p_game->board[square])) {
+                return keys[ZOBRIST_EP_FILE + FILE(ep)];
+            }
+        }
     }
 
-    move_st *elt = NULL;
-    LL_SEARCH(*plist, elt, &move, compare_moves);
+    return 0;
+}
 
-    if (NULL != elt) {
-        //LOGD("already existing %02x from %d to %d", elt->piece, elt->from, elt->to);
-        return true;
-    } else if (NULL != (elt = (move_st *)malloc(sizeof(move_st)))) {
-        memcpy(elt, &move, sizeof(move_st));
-        LL_APPEND(*plist, elt);
-        return true;
+uint64_t position_key(const game_st *p_game, const uint64_t *keys)
+{
+    if (NULL == keys)
+        keys = ZOBRIST.keys;
+
+    uint64_t key = castling_key(&p_game->stats, keys) ^ ep_key(p_game, keys);
+
+    for (uint8_t color = BLACK; color <= WHITE; color++) {
+        for (uint8_t n = 0; n < p_game->piece_count[color]; n++) {
+            uint8_t sq = p_game->pieces[color][n];
+            key ^= keys[ZOBRIST_PIECE(p_game->board[sq], sq)];
+        }
     }
 
-    LOGW("%s() failed", __func__);
-    return false;
+    if (WHITE == p_game->stats.turn) {
+        key ^= keys[ZOBRIST_TURN];
+    }
+
+    return key;
 }
 
-static inline void push(game_st *p_game, const move_st *move)
+/* place a piece on an empty square */
+static inline void put_piece(game_st *p_game, uint8_t square, uint8_t piece)
+{
+    uint8_t color = PIECE_COLOR(piece);
+    uint8_t n = p_game->piece_count[color]++;
+    p_game->pieces[color][n] = square;
+    p_game->piece_index[square] = n;
+    p_game->board[square] = piece;
+    p_game->stats.key ^= ZOBRIST.keys[ZOBRIST_PIECE(piece, square)];
+#if BITBOARDS
+    p_game->bitboards[color][BB_INDEX(PIECE_TYPE(piece))] |= BB_SQUARE(square);
+    p_game->occupied[color] |= BB_SQUARE(square);
+#endif
+}
+
+static inline void take_piece(game_st *p_game, uint8_t square)
+{
+    uint8_t piece = p_game->board[square];
+    uint8_t color = PIECE_COLOR(piece);
+    uint8_t n = p_game->piece_index[square];
+    uint8_t last = p_game->pieces[color][--p_game->piece_count[color]];
+    p_game->pieces[color][n] = last;
+    p_game->piece_index[last] = n;
+    p_game->board[square] = 0;
+    p_game->stats.key ^= ZOBRIST.keys[ZOBRIST_PIECE(piece, square)];
+#if BITBOARDS
+    p_game->bitboards[color][BB_INDEX(PIECE_TYPE(piece))] &= ~BB_SQUARE(square);
+    p_game->occupied[color] &= ~BB_SQUARE(square);
+#endif
+}
+
+/* move a piece to an empty square */
+static inline void shift_piece(game_st *p_game, uint8_t from, uint8_t to)
+{
+    uint8_t piece = p_game->board[from];
+    uint8_t n = p_game->piece_index[from];
+    p_game->pieces[PIECE_COLOR(piece)][n] = to;
+    p_game->piece_index[to] = n;
+    p_game->board[to] = piece;
+    p_game->board[from] = 0;
+    p_game->stats.key ^= ZOBRIST.keys[ZOBRIST_PIECE(piece, from)] ^ ZOBRIST.keys[ZOBRIST_PIECE(piece, to)];
+#if BITBOARDS
+    uint64_t u64_mask = BB_SQUARE(from) | BB_SQUARE(to);
+    p_game->bitboards[PIECE_COLOR(piece)][BB_INDEX(PIECE_TYPE(piece))] ^= u64_mask;
+    p_game->occupied[PIECE_COLOR(piece)] ^= u64_mask;
+#endif
+}
+
+/* exchange two pieces of the same color */
+static inline void swap_pieces(game_st *p_game, uint8_t a, uint8_t b)
 {
-    record_st *record = (record_st *)malloc(sizeof(record_st));
-    if (NULL != record) {
-        memset(record, 0, sizeof(record_st));
-        memcpy(&record->move, move, sizeof(move_st));
-        memcpy(&record->stats, &p_game->stats, sizeof(stats_st));
-        LL_APPEND(p_game->history, record);
+    uint8_t piece_a = p_game->board[a];
+    uint8_t piece_b = p_game->board[b];
+    uint8_t color = PIECE_COLOR(piece_a);
+    uint8_t n = p_game->piece_index[a];
+    p_game->pieces[color][n] = b;
+    p_game->pieces[color][p_game->piece_index[b]] = a;
+    p_game->piece_index[a] = p_game->piece_index[b];
+    p_game->piece_index[b] = n;
+    p_game->board[a] = piece_b;
+    p_game->board[b] = piece_a;
+    p_game->stats.key ^= ZOBRIST.keys[ZOBRIST_PIECE(piece_a, a)] ^ ZOBRIST.keys[ZOBRIST_PIECE(piece_a, b)] ^
+                         ZOBRIST.keys[ZOBRIST_PIECE(piece_b, b)] ^ ZOBRIST.keys[ZOBRIST_PIECE(piece_b, a)];
+#if BITBOARDS
+    uint64_t u64_mask = BB_SQUARE(a) | BB_SQUARE(b);
+    p_game->bitboards[color][BB_INDEX(PIECE_TYPE(piece_a))] ^= u64_mask;
+    p_game->bitboards[color][BB_INDEX(PIECE_TYPE(piece_b))] ^= u64_mask;
+#endif
+}
+
+/* castling king and rook may take each other's square or stay (chess960),
+   shifted in an order that keeps their pieces[] slots, for the pins of generate_moves() */
+static inline void castle_pieces(game_st *p_game, uint8_t king, uint8_t king_to, uint8_t rook, uint8_t rook_to)
+{
+    if ((king_to == rook) && (rook_to == king)) {
+        swap_pieces(p_game, king, rook);
+    } else if (king_to == rook) {
+        shift_piece(p_game, rook, rook_to);
+        shift_piece(p_game, king, king_to);
+    } else {
+        if (king != king_to)
+            shift_piece(p_game, king, king_to);
+        if (rook != rook_to)
+            shift_piece(p_game, rook, rook_to);
     }
 }
 
 void init_game(game_st *p_game)
 {
-    record_st *history = p_game->history;
-    if (history)
+    memset(p_game, 0, sizeof(game_st));
+    p_game->stats.castling_rooks[BLACK][1] = 7; // h file
+    p_game->stats.castling_rooks[WHITE][1] = 7;
+}
+
+bool index_position(game_st *p_game)
+{
+    p_game->piece_count[BLACK] = 0;
+    p_game->piece_count[WHITE] = 0;
+#if BITBOARDS
+    memset(p_game->bitboards, 0, sizeof(p_game->bitboards));
+    memset(p_game->occupied, 0, sizeof(p_game->occupied));
+#endif
+
+    for (uint8_t sq = a8; sq <= h1; sq++)
     {
-        record_st *elt, *tmp;
-        LL_FOREACH_SAFE(history, elt, tmp) {
-            //LOGD("del %c from %d to %d", elt->move.piece, elt->move.from, elt->move.to);
-            LL_DELETE(history, elt);
-            free(elt);
+        if (sq & 0x88)
+            continue;
+
+        uint8_t piece = p_game->board[sq];
+        if (0 == piece)
+            continue;
+
+        uint8_t color = PIECE_COLOR(piece);
+        if (p_game->piece_count[color] >= sizeof(p_game->pieces[color])) {
+            LOGW("too many pieces (color %u)", color);
+            return false;
         }
+        p_game->board[sq] = 0;
+        put_piece(p_game, sq, piece);
     }
-    memset(p_game, 0, sizeof(game_st));
+
+    p_game->stats.key = position_key(p_game);
+
+    return true;
+}
+
+/* outermost rook of the color on that side of the king, 0xFF if none */
+static inline uint8_t outer_rook(const game_st *p_game, uint8_t color, uint8_t side)
+{
+    uint8_t king = p_game->stats.kings[color];
+
+    for (uint8_t file = side ? 7 : 0; file != FILE(king); file += side ? -1 : 1) {
+        if (MAKE_PIECE(color, ROOK) == p_game->board[BACK_RANK[color] + file])
+            return file;
+    }
+
+    return 0xFF;
+}
+
+/* rights unchanged if the field is not valid for the position */
+bool parse_castling(game_st *p_game, const char *field)
+{
+    uint8_t castling[2] = { 0, 0 };
+    uint8_t rooks[2][2] = { { 0, 7 }, { 0, 7 } };
+
+    for (; *field && ('-' != *field) && (' ' != *field); field++)
+    {
+        uint8_t color = isupper((uint8_t)*field) ? WHITE : BLACK;
+        uint8_t king = p_game->stats.kings[color];
+        char    ch = tolower((uint8_t)*field);
+        uint8_t side, file;
+
+        if ((MAKE_PIECE(color, KING) != p_game->board[king]) || (RANK(king) != RANK(BACK_RANK[color]))) {
+            LOGW("castling %c without king", *field);
+            return false;
+        }
+
+        if (('k' == ch) || ('q' == ch)) {
+            side = ('k' == ch);
+            file = outer_rook(p_game, color, side);
+        } else if ((ch >= 'a') && (ch <= 'h')) {
+            // Shredder-FEN, or X-FEN for an inner rook
+            file = ch - 'a';
+            side = (file > FILE(king));
+        } else {
+            LOGW("castling %c", *field);
+            return false;
+        }
+
+        if ((file > 7) || (file == FILE(king)) || (MAKE_PIECE(color, ROOK) != p_game->board[BACK_RANK[color] + file])) {
+            LOGW("castling %c without rook", *field);
+            return false;
+        }
+
+        castling[color] |= CASTLE_FLAGS[side];
+        rooks[color][side] = file;
+    }
+
+    memcpy(p_game->stats.castling, castling, sizeof(castling));
+    memcpy(p_game->stats.castling_rooks, rooks, sizeof(rooks));
+
+    return true;
+}
+
+uint8_t format_castling(const game_st *p_game, char *buf)
+{
+    static const uint8_t COLORS[] = { WHITE, BLACK };
+    uint8_t len = 0;
+
+    for (uint8_t i = 0; i < sizeof(COLORS); i++) {
+        uint8_t color = COLORS[i];
+        for (uint8_t side = 2; side-- > 0; ) { // king side first
+            if (p_game->stats.castling[color] & CASTLE_FLAGS[side]) {
+                uint8_t file = p_game->stats.castling_rooks[color][side];
+                char ch = (file == outer_rook(p_game, color, side)) ? (side ? 'k' : 'q') : ('a' + file);
+                buf[len++] = (WHITE == color) ? toupper(ch) : ch;
+            }
+        }
+    }
+
+    if (0 == len) {
+        buf[len++] = '-';
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+bool chess960_position(const game_st *p_game)
+{
+    static const uint8_t COUNTS[] = { 0, 0, 2, 2, 2, 1, 1 }; // by PIECE_INT(), no pawn on the back rank
+    const uint8_t *board = p_game->board;
+    uint8_t counts[7] = { 0, };
+    uint8_t bishops = 0; // bit per square color
+    uint8_t rooks = 0;   // before the king
+
+    for (uint8_t file = 0; file < 8; file++)
+    {
+        uint8_t piece = board[a1 + file];
+        uint8_t type = PIECE_TYPE(piece);
+
+        // mirrored black pieces, pawns in front and nothing in between
+        if ((WHITE != PIECE_COLOR(piece)) || (MAKE_PIECE(BLACK, type) != board[a8 + file]) ||
+            ('P' != board[a2 + file]) || ('p' != board[a7 + file]))
+            return false;
+        for (uint8_t sq = a6 + file; sq < a2; sq += 16) {
+            if (0 != board[sq])
+                return false;
+        }
+
+        counts[PIECE_INT(type)]++;
+        if (BISHOP == type) {
+            bishops |= 1 << (file & 1);
+        } else if ((ROOK == type) && (0 == counts[PIECE_INT(KING)])) {
+            rooks++;
+        }
+    }
+
+    return (0 == memcmp(counts, COUNTS, sizeof(COUNTS))) && (3 == bishops) && (1 == rooks);
+}
+
+/* decimal field, false if empty or above max */
+static inline bool parse_counter(const char **p_text, uint16_t max, uint16_t *value)
+{
+    const char *text = *p_text;
+    uint32_t number = 0;
+
+    if (!isdigit((uint8_t)*text))
+        return false;
+    for (; isdigit((uint8_t)*text); text++) {
+        number = (number * 10) + (*text - '0');
+        if (number > max)
+            return false;
+    }
+
+    *p_text = text;
+    *value = (uint16_t)number;
+    return true;
+}
+
+bool load_fen(game_st *p_game, const char *fen)
+{
+    const char *text = fen;
+    uint8_t counts[2][2] = { { 0, 0 }, { 0, 0 } }; // kings and pawns per color
+    uint8_t sq = a8;
+    bool b_digit = false; // no two digits in a row
+
+    init_game(p_game);
+
+    /* placement, rank 8 first */
+    for (; ' ' != *text; text++)
+    {
+        char ch = *text;
+
+        if ('/' == ch) {
+            if ((8 != FILE(sq)) || (RANK(sq) == RANK_1))
+                break;
+            sq += 8;
+            b_digit = false;
+        } else if ((ch >= '1') && (ch <= '8')) {
+            if (b_digit || (FILE(sq) + (ch - '0') > 8))
+                break;
+            sq += ch - '0';
+            b_digit = true;
+        } else {
+            uint8_t type = PIECE_TYPE(ch);
+            uint8_t color = PIECE_COLOR(ch);
+            if ((_NONE == type) || (FILE(sq) > 7))
+                break;
+            if (PAWN == type) {
+                if ((RANK(sq) == RANK_1) || (RANK(sq) == RANK_8) || (++counts[color][1] > 8))
+                    break;
+            } else if (KING == type) {
+                if (++counts[color][0] > 1)
+                    break;
+                p_game->stats.kings[color] = sq;
+            }
+            p_game->board[sq++] = ch;
+            b_digit = false;
+        }
+    }
+    if ((' ' != *text) || (h1 + 1 != sq) || (1 != counts[WHITE][0]) || (1 != counts[BLACK][0])) {
+        LOGW("fen placement at %u", (unsigned)(text - fen));
+        return false;
+    }
+
+    /* side to move */
+    text++;
+    if ((('w' != text[0]) && ('b' != text[0])) || (' ' != text[1])) {
+        LOGW("fen turn");
+        return false;
+    }
+    p_game->stats.turn = ('w' == text[0]) ? WHITE : BLACK;
+    text += 2;
+
+    /* castling, KQkq, X-FEN or Shredder-FEN */
+    const char *end = strchr(text, ' ');
+    uint8_t len = end ? (uint8_t)(end - text) : 0;
+    if ((0 == len) || (len > 4) || ((1 != len) && memchr(text, '-', len)) ||
+        (('-' != *text) && !parse_castling(p_game, text))) {
+        LOGW("fen castling");
+        return false;
+    }
+    text += len + 1;
+
+    /* en passant, a pawn of the other side just moved two squares */
+    if ('-' == *text) {
+        text++;
+    } else {
+        uint8_t us = p_game->stats.turn;
+        uint8_t them = SWAP_COLOR(us);
+        uint8_t ep = ((WHITE == us) ? a6 : a3) + (text[0] - 'a');
+        if ((text[0] < 'a') || (text[0] > 'h') || (text[1] != ((WHITE == us) ? '6' : '3')) ||
+            (0 != p_game->board[ep]) || (0 != p_game->board[ep + PIECE_OFFSETS[us][0]]) ||
+            (MAKE_PIECE(them, PAWN) != p_game->board[ep - PIECE_OFFSETS[us][0]])) {
+            LOGW("fen en passant");
+            return false;
+        }
+        p_game->stats.ep_square = ep;
+        text += 2;
+    }
+
+    /* move counters, both or none */
+    p_game->stats.move_number = 1;
+    if (('\0' != *text) &&
+        ((' ' != *text++) || !parse_counter(&text, 9999, &p_game->stats.half_moves) ||
+         (' ' != *text++) || !parse_counter(&text, 9999, &p_game->stats.move_number) ||
+         (0 == p_game->stats.move_number) || ('\0' != *text))) {
+        LOGW("fen counters");
+        return false;
+    }
+
+    // the side that just moved cannot be in check
+    if (!index_position(p_game) || KING_ATTACKED(p_game, SWAP_COLOR(p_game->stats.turn))) {
+        LOGW("fen position");
+        return false;
+    }
+
+    return true;
 }
 
 void make_move(game_st *p_game, const move_st *move)
 {
     uint8_t us = PIECE_COLOR(move->piece);
     uint8_t them = SWAP_COLOR(us);
-    uint8_t *board = p_game->board;
 
     push(p_game, move);
 
-    board[move->to]   = board[move->from];
-    board[move->from] = 0;
+    /* pieces are hashed by the board helpers, the rest is swapped in at the end */
+    p_game->stats.key ^= castling_key(&p_game->stats) ^ ep_key(p_game);
+
+    if (move->flags & BITS_CASTLE) {
+        uint8_t side = CASTLE_SIDE(move->flags);
+        castle_pieces(p_game, move->from, move->to, CASTLING_ROOK(&p_game->stats, us, side), BACK_RANK[us] + CASTLED_ROOK[side]);
+    } else {
+        if (move->flags & BIT_CAPTURE) {
+            take_piece(p_game, move->to);
+        }
+        shift_piece(p_game, move->from, move->to);
+    }
 
     if (KING == PIECE_TYPE(move->piece))
     {
         p_game->stats.kings[us] = move->to;
 
-        /* if we castled, move the rook next to the king */
-        if (move->flags & BIT_KSIDE_CASTLE) {
-            board[move->to - 1] = board[move->to + 1];
-            board[move->to + 1] = 0;
-        } else if (move->flags & BIT_QSIDE_CASTLE) {
-            board[move->to + 1] = board[move->to - 2];
-            board[move->to - 2] = 0;
-        }
-
         /* turn off castling */
         p_game->stats.castling[us] = 0;
     }
@@ -160,29 +612,30 @@ void make_move(game_st *p_game, const move_st *move)
     {
         /* if ep capture, remove the captured pawn */
         if (move->flags & BIT_EP_CAPTURE) {
-            board[move->to - PIECE_OFFSETS[us][0]] = 0;
+            take_piece(p_game, move->to - PIECE_OFFSETS[us][0]);
         }
 
         /* if pawn promotion, replace with new piece */
         if (move->flags & BIT_PROMOTION) {
-            board[move->to] = MAKE_PIECE(us, move->promoted ? move->promoted : (uint8_t)QUEEN);
+            take_piece(p_game, move->to);
+            put_piece(p_game, move->to, MAKE_PIECE(us, move->promoted ? move->promoted : (uint8_t)QUEEN));
         }
     }
 
     /* turn off castling if we move a rook */
     if (ROOK == PIECE_TYPE(move->piece)) {
-        for (uint8_t i = 0; i < 4; i = i + 2) {
-            if (ROOKS[us][i] == move->from) {
-                p_game->stats.castling[us] &= ~ROOKS[us][i+1];
+        for (uint8_t side = 0; side < 2; side++) {
+            if (CASTLING_ROOK(&p_game->stats, us, side) == move->from) {
+                p_game->stats.castling[us] &= ~CASTLE_FLAGS[side];
             }
         }
     }
 
     /* turn off castling if we capture a rook */
     if (ROOK == PIECE_TYPE(move->captured)) {
-        for (uint8_t i = 0; i < 4; i = i + 2) {
-            if (ROOKS[them][i] == move->to) {
-                p_game->stats.castling[them] &= ~ROOKS[them][i+1];
+        for (uint8_t side = 0; side < 2; side++) {
+            if (CASTLING_ROOK(&p_game->stats, them, side) == move->to) {
+                p_game->stats.castling[them] &= ~CASTLE_FLAGS[side];
             }
         }
     }
@@ -208,84 +661,292 @@ void make_move(game_st *p_game, const move_st *move)
     }
 
     p_game->stats.turn = them;
+    p_game->stats.key ^= castling_key(&p_game->stats) ^ ep_key(p_game) ^ ZOBRIST.keys[ZOBRIST_TURN];
 }
 
 bool undo_move(game_st *p_game, move_st *last)
 {
-    if ((NULL == p_game) || (NULL == p_game->history))
+    if ((NULL == p_game) || (0 == p_game->undos))
         return false;
 
-    uint8_t *board = p_game->board;
-    record_st *record = p_game->history;
-    while (NULL != record->next) {
-        record = record->next; // get last added
-    }
+    p_game->plies--;
+    p_game->undos--;
+    const record_st *record = &p_game->history[p_game->plies & (MAX_HISTORY - 1)];
 
     const move_st *move = &record->move;
-    memcpy(&p_game->stats, &record->stats, sizeof(stats_st));
     if (last)
         memcpy(last, move, sizeof(move_st));
 
     uint8_t us = PIECE_COLOR(move->piece);
     uint8_t them = SWAP_COLOR(us);
 
-    board[move->from] = board[move->to];
-    board[move->to] = 0;
-
-    if (move->flags & BIT_KSIDE_CASTLE) {
-        board[move->to + 1] = board[move->to - 1];
-        board[move->to - 1] = 0;
-    } else if (move->flags & BIT_QSIDE_CASTLE) {
-        board[move->to - 2] = board[move->to + 1];
-        board[move->to + 1] = 0;
+    if (move->flags & BITS_CASTLE) {
+        /* rook square from the rights before the move */
+        uint8_t side = CASTLE_SIDE(move->flags);
+        castle_pieces(p_game, move->to, move->from, BACK_RANK[us] + CASTLED_ROOK[side], CASTLING_ROOK(&record->stats, us, side));
     } else { // non-castling
+        shift_piece(p_game, move->to, move->from);
+
         if (move->flags & BIT_PROMOTION) {
-            board[move->from] = MAKE_PIECE(PIECE_COLOR(move->piece), PAWN);
+            take_piece(p_game, move->from);
+            put_piece(p_game, move->from, MAKE_PIECE(us, PAWN));
         }
 
         if (move->flags & BIT_CAPTURE) {
-            board[move->to] = move->captured;
+            put_piece(p_game, move->to, move->captured);
         } else if (move->flags & BIT_EP_CAPTURE) {
-            uint8_t index = move->to - PIECE_OFFSETS[us][0];
-            board[index] = MAKE_PIECE(them, PAWN);
+            put_piece(p_game, move->to - PIECE_OFFSETS[us][0], MAKE_PIECE(them, PAWN));
+        }
+    }
+
+    /* after the board helpers, restores the key too */
+    memcpy(&p_game->stats, &record->stats, sizeof(stats_st));
+
+    return true;
+}
+
+uint8_t repetitions(const game_st *p_game)
+{
+    uint8_t  count = 1;
+    uint16_t depth = p_game->stats.half_moves;
+
+    /* no position repeats across a capture, pawn move or lost right,
+       so only the records since the last irreversible move are checked */
+    if (depth > p_game->undos)
+        depth = p_game->undos;
+
+    /* same side to move every second ply */
+    for (uint16_t ply = 4; ply <= depth; ply += 2) {
+        const record_st *record = &p_game->history[(p_game->plies - ply) & (MAX_HISTORY - 1)];
+        if ((record->stats.key == p_game->stats.key) && (++count >= 5))
+            break;
+    }
+
+    return count;
+}
+
+bool insufficient_material(const game_st *p_game)
+{
+    uint8_t minors = 0;
+    uint8_t knights = 0;
+    uint8_t bishop_colors = 0; // bit per square color
+
+    for (uint8_t color = BLACK; color <= WHITE; color++) {
+        for (uint8_t n = 0; n < p_game->piece_count[color]; n++) {
+            uint8_t sq = p_game->pieces[color][n];
+            switch (PIECE_TYPE(p_game->board[sq])) {
+            case KING:
+                break;
+            case KNIGHT:
+                knights++;
+                minors++;
+                break;
+            case BISHOP:
+                bishop_colors |= 1 << ((RANK(sq) + FILE(sq)) & 1);
+                minors++;
+                break;
+            default: // pawn, rook or queen
+                return false;
+            }
         }
     }
 
-    LL_DELETE(p_game->history, record);
-    free(record);
+    /* lone minor piece, or bishops all on the same square color */
+    return (minors <= 1) || ((0 == knights) && (3 != bishop_colors));
+}
+
+uint8_t game_result(const game_st *p_game, uint8_t move_count)
+{
+    if (0 == move_count)
+        return IN_CHECK(p_game) ? RESULT_CHECKMATE : RESULT_STALEMATE;
+    if (insufficient_material(p_game))
+        return RESULT_INSUFFICIENT;
+    if (p_game->stats.half_moves >= 150)
+        return RESULT_SEVENTY_FIVE_MOVES;
+
+    if (repetitions(p_game) >= 5)
+        return RESULT_FIVEFOLD;
+
+    return RESULT_NONE;
+}
+
+uint8_t claimable_draw(const game_st *p_game)
+{
+    if (p_game->stats.half_moves >= 100)
+        return RESULT_FIFTY_MOVES;
+    if (repetitions(p_game) >= 3)
+        return RESULT_THREEFOLD;
+
+    return RESULT_NONE;
+}
+
+/* checkers and pinned pieces of the side to move */
+typedef struct {
+    uint8_t  checkers;          // number of pieces giving check
+    uint32_t au32_evasions[4];  // 0x88 squares capturing or blocking a single checker
+    int8_t   ai8_pins[16];      // per pieces[us][] slot: ray step from king to pinner, 0 if not pinned
+} pins_st;
+
+#define SET_SQUARE(bits, sq)            ((bits)[(sq) >> 5] |= (1UL << ((sq) & 31)))
+#define HAS_SQUARE(bits, sq)            (0 != ((bits)[(sq) >> 5] & (1UL << ((sq) & 31))))
+
+#if LEGAL_MOVEGEN
+static void find_pins(const game_st *p_game, uint8_t us, pins_st *pins)
+{
+    const uint8_t *board = p_game->board;
+    uint8_t them = SWAP_COLOR(us);
+    uint8_t king = p_game->stats.kings[us];
+
+    memset(pins, 0, sizeof(pins_st));
+
+    for (uint8_t n = 0; n < p_game->piece_count[them]; n++)
+    {
+        uint8_t i = p_game->pieces[them][n];
+        uint8_t type = PIECE_TYPE(board[i]);
+        int16_t difference = i - king;
+        int16_t index = difference + h1;
+
+        if (!(ATTACKS[index] & (1 << SHIFTS[PIECE_INT(type)])))
+            continue;
+
+        if (PAWN == type) {
+            if ((difference > 0) != (WHITE == them))
+                continue;
+        } else if ((KNIGHT != type) && (KING != type)) {
+            int8_t  offset = RAYS[index];
+            uint8_t blocker = 0;
+            uint8_t blockers = 0;
+            for (int16_t j = i + offset; j != king; j += offset) {
+                if (0 != board[j]) {
+                    blocker = j;
+                    if (++blockers > 1)
+                        break;
+                }
+            }
+
+            if (1 == blockers) {
+                if (PIECE_COLOR(board[blocker]) == us) {
+                    pins->ai8_pins[p_game->piece_index[blocker]] = -offset;
+                }
+                continue;
+            } else if (blockers > 1) {
+                continue;
+            }
+
+            for (int16_t j = i + offset; j != king; j += offset) {
+                SET_SQUARE(pins->au32_evasions, j);
+            }
+        }
+
+        SET_SQUARE(pins->au32_evasions, i);
+        pins->checkers++;
+    }
+}
+#endif
+
+static inline bool legal_move(game_st *p_game, const pins_st *pins, const move_st *move)
+{
+    uint8_t us = PIECE_COLOR(move->piece);
+
+#if LEGAL_MOVEGEN
+    /* king moves and en passant (discovered rank attacks) still go through make/undo */
+    if ((KING != PIECE_TYPE(move->piece)) && !(move->flags & BIT_EP_CAPTURE))
+    {
+        int8_t pin = pins->ai8_pins[p_game->piece_index[move->from]];
+
+        /* pinned pieces may only move along the pin ray */
+        if ((0 != pin) && (RAYS[move->to - p_game->stats.kings[us] + h1] != -pin))
+            return false;
+
+        /* single check: capture the checker or block it (double check has king moves only) */
+        return (0 == pins->checkers) || HAS_SQUARE(pins->au32_evasions, move->to);
+    }
+#else
+    (void)pins;
+#endif
+
+    make_move(p_game, move);
+    bool valid = !KING_ATTACKED(p_game, us);
+    undo_move(p_game);
+
+    return valid;
+}
+
+/* the squares between the king, the rook and their destinations are empty but for both,
+   the king does not start from, cross or land on an attacked square */
+static inline bool castling_allowed(const game_st *p_game, uint8_t them, uint8_t side)
+{
+    uint8_t us = SWAP_COLOR(them);
+    uint8_t king = p_game->stats.kings[us];
+    uint8_t rook = CASTLING_ROOK(&p_game->stats, us, side);
+    uint8_t king_to = BACK_RANK[us] + CASTLED_KING[side];
+    uint8_t rook_to = BACK_RANK[us] + CASTLED_ROOK[side];
+    const uint8_t squares[] = { king, king_to, rook, rook_to };
+    uint8_t first = h1, last = a8;
+
+    if (MAKE_PIECE(us, ROOK) != p_game->board[rook])
+        return false;
+
+    for (uint8_t n = 0; n < sizeof(squares); n++) {
+        if (squares[n] < first) first = squares[n];
+        if (squares[n] > last) last = squares[n];
+    }
+
+    for (uint8_t sq = first; sq <= last; sq++) {
+        if ((0 != p_game->board[sq]) && (sq != king) && (sq != rook))
+            return false;
+    }
+
+    first = (king < king_to) ? king : king_to;
+    last  = (king < king_to) ? king_to : king;
+    for (uint8_t sq = first; sq <= last; sq++) {
+        if (attacked(p_game, them, sq))
+            return false;
+    }
 
     return true;
 }
 
-move_st *generate_moves(game_st *p_game)
+uint8_t generate_moves(game_st *p_game, move_list_st *list)
 {
     uint8_t us = p_game->stats.turn;
     uint8_t them = SWAP_COLOR(us);
     uint8_t *board = p_game->board;
 
-    move_st *move_list = NULL;
+    seen_st seen;
+    seen.from = 0xFF; // none
+    list->count = 0;
 
-    for (uint8_t i = 0; i < sizeof(p_game->board); i++)
+    pins_st pins;
+#if LEGAL_MOVEGEN
+    find_pins(p_game, us, &pins);
+#endif
+
+    for (uint8_t n = 0; n < p_game->piece_count[us]; n++)
     {
+        uint8_t i = p_game->pieces[us][n];
         uint8_t piece = board[i];
-        if ((0 == piece) || (us != PIECE_COLOR(piece)))
-            continue;
         //LOGD("piece %02x @ %d", piece, i);
 
         //uint8_t row = RANK(i);
         //uint8_t col = FILE(i);
         uint8_t type= PIECE_TYPE(piece);
 
+#if LEGAL_MOVEGEN
+        if ((pins.checkers > 1) && (KING != type))
+            continue; // double check, only the king can move
+#endif
+
         if (PAWN == type)
         {
             /* single square, non-capturing */
             int16_t square = i + PIECE_OFFSETS[us][0];
             if (0 == board[square]) {
-                add_move(p_game, &move_list, i, square, BIT_NORMAL);
+                add_move(p_game, list, &seen, i, square, BIT_NORMAL);
                 /* double square */
                 square = i + PIECE_OFFSETS[us][1];
-                if ((0 == board[square]) && (SECOND_RANK[us] == RANK(i))) {
-                    add_move(p_game, &move_list, i, square, BIT_BIG_PAWN);
+                if ((SECOND_RANK[us] == RANK(i)) && (0 == board[square])) {
+                    add_move(p_game, list, &seen, i, square, BIT_BIG_PAWN);
                 }
             }
 
@@ -295,14 +956,24 @@ move_st *generate_moves(game_st *p_game)
                 if (square & 0x88)
                     continue;
                 if ((0 != board[square]) && PIECE_COLOR(board[square]) != us) {
-                    add_move(p_game, &move_list, i, square, BIT_CAPTURE);
+                    add_move(p_game, list, &seen, i, square, BIT_CAPTURE);
                 } else if ((0 != p_game->stats.ep_square) && (square == p_game->stats.ep_square)) {
-                    add_move(p_game, &move_list, i, square, BIT_EP_CAPTURE);
+                    add_move(p_game, list, &seen, i, square, BIT_EP_CAPTURE);
                 }
             }
         }
         else // non-pawn
         {
+#if BITBOARDS
+            uint64_t occupied = p_game->occupied[WHITE] | p_game->occupied[BLACK];
+            uint64_t targets  = piece_attacks(type, SQUARE_TO_IDX(i), occupied) & ~p_game->occupied[us];
+
+            while (0 != targets) {
+                uint8_t square = IDX_TO_SQUARE(__builtin_ctzll(targets));
+                targets &= targets - 1; // next
+                add_move(p_game, list, &seen, i, square, (0 == board[square]) ? BIT_NORMAL : BIT_CAPTURE);
+            }
+#else
             for (uint8_t j = 0; j < 8; j++) {
                 int16_t offset = PIECE_OFFSETS[PIECE_INT(type)][j];
                 int16_t square = i;
@@ -312,11 +983,11 @@ move_st *generate_moves(game_st *p_game)
                     if (square & 0x88)
                         break;
                     if (0 == board[square]) {
-                        add_move(p_game, &move_list, i, square, BIT_NORMAL);
+                        add_move(p_game, list, &seen, i, square, BIT_NORMAL);
                     } else {
                         if (PIECE_COLOR(p_game->board[square]) == us)
                             break;
-                        add_move(p_game, &move_list, i, square, BIT_CAPTURE);
+                        add_move(p_game, list, &seen, i, square, BIT_CAPTURE);
                         break;
                     }
 
@@ -325,151 +996,317 @@ move_st *generate_moves(game_st *p_game)
                         break;
                 } // while loop
             } // offsets
+#endif
 
             // castling
-            if ((KINGS[us] == i) && (KING == type)) {
-                uint8_t castling_from = i;
-                // king side
-                if (p_game->stats.castling[us] & BIT_KSIDE_CASTLE) {
-                    uint8_t castling_to = castling_from + 2;
-                    if ((0 == board[castling_from + 1]) &&
-                        (0 == board[castling_to]) &&
-                        !attacked(board, them, castling_from) &&
-                        !attacked(board, them, castling_from + 1) &&
-                        !attacked(board, them, castling_to)) {
-                            add_move(p_game, &move_list, castling_from, castling_to, BIT_KSIDE_CASTLE);
-                    }
-                }
-                // queen-side
-                if (p_game->stats.castling[us] & BIT_QSIDE_CASTLE) {
-                    uint8_t castling_to = castling_from - 2;
-                    if ((0 == board[castling_from - 1]) &&
-                        (0 == board[castling_from - 2]) &&
-                        (0 == board[castling_from - 3]) &&
-                        !attacked(board, them, castling_from) &&
-                        !attacked(board, them, castling_from - 1) &&
-                        !attacked(board, them, castling_to)) {
-                            add_move(p_game, &move_list, castling_from, castling_to, BIT_QSIDE_CASTLE);
+            if ((KING == type) && p_game->stats.castling[us]) {
+                for (uint8_t side = 0; side < 2; side++) {
+                    uint8_t castling_to = BACK_RANK[us] + CASTLED_KING[side];
+                    if ((p_game->stats.castling[us] & CASTLE_FLAGS[side]) && castling_allowed(p_game, them, side)) {
+                        add_move(p_game, list, &seen, i, castling_to, CASTLE_FLAGS[side]);
                     }
                 }
             } // castling
         }
     } // all squares
 
-    move_st *elt, *tmp;
-    // filter out illegal moves
-    LL_FOREACH_SAFE(move_list, elt, tmp) {
-        make_move(p_game, elt);
-        bool valid = !KING_ATTACKED(p_game, us);
-        undo_move(p_game);
-
-        if (!valid) {
+    // filter out illegal moves, index the legal ones by origin
+    uint8_t count = 0;
+    list->origins = 0;
+    for (uint8_t i = 0; i < list->count; i++) {
+        const move_st *elt = &list->moves[i];
+        if (!legal_move(p_game, &pins, elt)) {
             //LOGD("invalid move %c %c%u-%c%u", elt->piece, ALGEBRAIC(elt->from), ALGEBRAIC(elt->to));
-            LL_DELETE(move_list, elt);
-            free(elt);
-        //} else {
-        //    LOGD("valid move %c %c%u-%c%u", elt->piece, ALGEBRAIC(elt->from), ALGEBRAIC(elt->to));
+            continue;
+        }
+        //LOGD("valid move %c %c%u-%c%u", elt->piece, ALGEBRAIC(elt->from), ALGEBRAIC(elt->to));
+        if (count != i) {
+            list->moves[count] = *elt;
         }
+        count++;
+
+        /* targets of an origin are cleared on its first move only */
+        uint8_t idx = SQUARE_TO_IDX(elt->from);
+        if (0 == (list->origins & (1ULL << idx))) {
+            list->origins |= 1ULL << idx;
+            list->targets[idx] = 0;
+        }
+        list->targets[idx] |= BB_SQUARE(elt->to);
     }
+    list->count = count;
 
-    return move_list;
+    return count;
 }
 
 /* note: limited handling of ambiguities */
-bool move_to_san(move_st *list, const move_st *p_move, char *san_buf, uint8_t buf_sz)
-{
-    move_st *similar = NULL;
-    char *san = san_buf;
-
-    move_st *elt;
-    LL_FOREACH(list, elt) {
-        if ((PAWN != PIECE_TYPE(p_move->piece)) && (p_move->piece == elt->piece) &&
-            (p_move->to == elt->to) && (p_move->from != elt->from)) {
-            if (NULL != similar) {
-                // to do
-                LOGW("too many ambiguities");
-            }
-            similar = elt;
-        }
-    }
+bool move_to_san(const move_list_st *list, const move_st *p_move, char *san_buf, uint8_t buf_sz, game_st *p_game)
+{
+    char san[12]; // longest is "Qa1xb2=Q+" style, 9 chars
+    uint8_t len = 0;
+    uint8_t type = PIECE_TYPE(p_move->piece);
+
+    if ((NULL == list) || (NULL == p_move) || (NULL == san_buf) || (0 == buf_sz))
+        return false;
 
     if (p_move->flags & BIT_KSIDE_CASTLE)
     {
-        strncpy(san_buf, "O-O", buf_sz);
+        san[len++] = 'O'; san[len++] = '-'; san[len++] = 'O';
     }
     else if (p_move->flags & BIT_QSIDE_CASTLE)
     {
-        strncpy(san_buf, "O-O-O", buf_sz);
+        san[len++] = 'O'; san[len++] = '-'; san[len++] = 'O'; san[len++] = '-'; san[len++] = 'O';
     }
-    else if (NULL == similar)
+    else
     {
-        if (PAWN == PIECE_TYPE(p_move->piece))
+        if (PAWN == type)
         {
             if (p_move->flags & (BIT_CAPTURE | BIT_EP_CAPTURE)) {
-                san += snprintf(san, buf_sz, "%cx", FILE(p_move->from) + 'a');
+                san[len++] = 'a' + FILE(p_move->from);
             }
-            san += snprintf(san, buf_sz - 2, "%c%u", ALGEBRAIC(p_move->to));
         }
         else // officials
         {
-            *san++ = toupper(PIECE_TYPE(p_move->piece));
-            if (p_move->flags & BIT_CAPTURE) {
-                *san++ = 'x';
+            /* other pieces of the same kind reaching the same square */
+            bool same_file = false, same_rank = false, ambiguous = false;
+            const move_st *elt;
+            MOVES_FOREACH(list, elt) {
+                if ((p_move->piece == elt->piece) && (p_move->to == elt->to) && (p_move->from != elt->from)) {
+                    ambiguous = true;
+                    same_file |= (FILE(p_move->from) == FILE(elt->from));
+                    same_rank |= (RANK(p_move->from) == RANK(elt->from));
+                }
             }
-            snprintf(san, buf_sz - 2, "%c%u", ALGEBRAIC(p_move->to));
+
+            san[len++] = toupper(type);
+            if (ambiguous && (!same_file || same_rank)) {
+                san[len++] = 'a' + FILE(p_move->from);
+            }
+            if (ambiguous && same_file) {
+                san[len++] = '0' + 8 - RANK(p_move->from);
+            }
+        }
+
+        if (p_move->flags & (BIT_CAPTURE | BIT_EP_CAPTURE)) {
+            san[len++] = 'x';
+        }
+        san[len++] = 'a' + FILE(p_move->to);
+        san[len++] = '0' + 8 - RANK(p_move->to);
+
+        if (p_move->flags & BIT_PROMOTION) {
+            san[len++] = '=';
+            san[len++] = toupper(PIECE_TYPE(p_move->promoted));
+        }
+    }
+
+    if (NULL != p_game)
+    {
+        /* shared scratch: a move_list_st is 1832 B, too much for the 4 kB Board task stack,
+           callers passing p_game hold the game lock */
+        static move_list_st s_replies;
+
+        make_move(p_game, p_move);
+        if (IN_CHECK(p_game)) {
+            san[len++] = generate_moves(p_game, &s_replies) ? '+' : '#';
         }
+        undo_move(p_game);
+    }
+
+    if (len >= buf_sz)
+        len = buf_sz - 1;
+    memcpy(san_buf, san, len);
+    san_buf[len] = '\0';
+
+    return true;
+}
+
+bool parse_move(const move_list_st *list, const char *text, move_st *p_move, const game_st *p_game)
+{
+    uint8_t type = _NONE;
+    uint8_t promoted = _NONE;
+    uint8_t castle = 0;
+    uint8_t files = 0, ranks = 0;
+    uint8_t file[2] = {0, }, rank[2] = {0, }; // last one is the destination
+    const char *start = text;
+    const move_st *found = NULL;
+
+    if ((NULL == list) || (NULL == text) || (NULL == p_move))
+        return false;
+
+    while (' ' == *text)
+        text++;
+
+    if ((('O' == text[0]) || ('0' == text[0])) && ('-' == text[1]) && (text[0] == text[2])) {
+        castle = (('-' == text[3]) && (text[0] == text[4])) ? BIT_QSIDE_CASTLE : BIT_KSIDE_CASTLE;
     }
     else
     {
-        *san++ = toupper(PIECE_TYPE(p_move->piece));
-        if (FILE(p_move->from) != FILE(similar->from)) {
-            *san++ = 'a' + FILE(p_move->from);
-        } else if (RANK(p_move->from) != RANK(similar->from)) {
-            *san++ = '0' + 8 - RANK(p_move->from);
+        if (*text && strchr("KQRBN", *text)) {
+            type = tolower(*text++);
+        }
+
+        bool dest = false; // last coordinate was a rank
+        for (char ch, prev = 0; (ch = *text) != '\0'; prev = ch, text++)
+        {
+            if (('x' == ch) || (':' == ch) || ('-' == ch) || ('=' == ch)) {
+                continue;
+            } else if ((ch >= '1') && (ch <= '8') && (ranks < 2)) {
+                rank[ranks++] = 8 - (ch - '0');
+                dest = true;
+            } else if (dest && (_NONE == type) && (_NONE == promoted) &&
+                       (strchr("QRBN", ch) || (strchr("qrbn", ch) && (('=' == prev) || ((2 == files) && (2 == ranks)))))) {
+                // "e8=Q", "e8Q" or uci "e7e8q"
+                promoted = tolower(ch);
+            } else if ((ch >= 'a') && (ch <= 'h') && (files < 2)) {
+                dest = false;
+                file[files++] = ch - 'a';
+            } else {
+                break; // "+", "#", annotations or the next token
+            }
+        }
+
+        if ((0 == files) || (0 == ranks))
+            return false;
+    }
+
+    uint8_t to = (rank[ranks ? ranks - 1 : 0] << 4) + file[files ? files - 1 : 0];
+    bool from_file = (2 == files);
+    bool from_rank = (2 == ranks);
+    bool uci = (_NONE == type) && (2 == files) && (2 == ranks);
+
+    const move_st *elt;
+    MOVES_FOREACH(list, elt) {
+        if (castle) {
+            if (!(elt->flags & castle))
+                continue;
+        } else if (elt->flags & BITS_CASTLE) {
+            // uci only, the king two squares aside or onto its own rook (chess960)
+            uint8_t rook = p_game ? (uint8_t)CASTLING_ROOK(&p_game->stats, PIECE_COLOR(elt->piece), CASTLE_SIDE(elt->flags)) : 0xFF;
+            if (!uci || (FILE(elt->from) != file[0]) || (RANK(elt->from) != rank[0]))
+                continue;
+            if ((to != rook) && ((to != elt->to) || ((FILE(to) + 2 != FILE(elt->from)) && (FILE(elt->from) + 2 != FILE(to)))))
+                continue;
         } else {
-            *san++ = 'a' + FILE(p_move->from);
-            *san++ = '0' + 8 - RANK(p_move->from);
+            if (elt->to != to)
+                continue;
+            if (!uci && (PIECE_TYPE(elt->piece) != ((_NONE == type) ? (uint8_t)PAWN : type)))
+                continue;
+            if (from_file && (FILE(elt->from) != file[0]))
+                continue;
+            if (from_rank && (RANK(elt->from) != rank[0]))
+                continue;
         }
 
-        san += snprintf(san, buf_sz - 4, "%c%u", ALGEBRAIC(p_move->to));
+        if (NULL != found) {
+            LOGW("ambiguous move %.8s", start);
+            return false;
+        }
+        found = elt;
     }
 
+    if (NULL == found)
+        return false;
+
+    memcpy(p_move, found, sizeof(move_st));
     if (p_move->flags & BIT_PROMOTION) {
-        *san++ = '=';
-        *san++ = toupper(PIECE_TYPE(p_move->promoted));
+        p_move->promoted = (_NONE != promoted) ? promoted : (uint8_t)QUEEN;
     }
 
     return true;
 }
 
-bool find_move(game_st *p_game /*board*/, move_st *list /*moves list*/, const uint8_t *scan /*input or desired raw position*/, move_st *p_move /*found move*/)
+/* scan index bits where the scan differs from the board */
+static inline uint64_t changed_squares(const game_st *p_game, const uint8_t *scan)
+{
+    uint64_t changed = 0;
+
+    /* a rank per word (little endian): scan rank against the 0x88 row, each differing byte folded to its bit */
+    for (uint8_t rank = 0; rank < 8; rank++) {
+        uint64_t word;
+        uint64_t row;
+        memcpy(&word, scan + (rank << 3), sizeof(word));
+        memcpy(&row, p_game->board + ((7 - rank) << 4), sizeof(row));
+        word ^= row;
+        word |= word >> 4;
+        word |= word >> 2;
+        word |= word >> 1;
+        changed |= (((word & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56) << (rank << 3);
+    }
+
+    return changed;
+}
+
+/* squares a move changes: 2 for normal moves, 3 for en passant, 2 to 4 for castling */
+static inline uint64_t move_signature(const game_st *p_game, const move_st *move)
+{
+    if (move->flags & BITS_CASTLE) {
+        // the king or the rook may stay in place (chess960)
+        uint8_t us = PIECE_COLOR(move->piece);
+        uint8_t side = CASTLE_SIDE(move->flags);
+        uint8_t rook = CASTLING_ROOK(&p_game->stats, us, side);
+        uint8_t rook_to = BACK_RANK[us] + CASTLED_ROOK[side];
+        return ((move->from != move->to) ? (BB_SQUARE(move->from) | BB_SQUARE(move->to)) : 0) |
+               ((rook != rook_to) ? (BB_SQUARE(rook) | BB_SQUARE(rook_to)) : 0);
+    }
+
+    uint64_t mask = BB_SQUARE(move->from) | BB_SQUARE(move->to);
+
+    if (move->flags & BIT_EP_CAPTURE) {
+        mask |= BB_SQUARE(move->to - PIECE_OFFSETS[PIECE_COLOR(move->piece)][0]);
+    }
+
+    return mask;
+}
+
+/* the changed squares of the scan hold what the move leaves there */
+static inline bool scan_matches(const game_st *p_game, const move_st *move, const uint8_t *scan)
+{
+    uint8_t us = PIECE_COLOR(move->piece);
+    uint8_t piece = scan[SQUARE_TO_IDX(move->to)];
+
+    if (move->flags & BITS_CASTLE) {
+        // squares left by one piece may be taken by the other
+        uint8_t side = CASTLE_SIDE(move->flags);
+        uint8_t rook = CASTLING_ROOK(&p_game->stats, us, side);
+        uint8_t rook_to = BACK_RANK[us] + CASTLED_ROOK[side];
+        return (piece == move->piece) && (MAKE_PIECE(us, ROOK) == scan[SQUARE_TO_IDX(rook_to)]) &&
+               ((move->from == rook_to) || (move->from == move->to) || (0 == scan[SQUARE_TO_IDX(move->from)])) &&
+               ((rook == move->to) || (rook == rook_to) || (0 == scan[SQUARE_TO_IDX(rook)]));
+    }
+
+    if (0 != scan[SQUARE_TO_IDX(move->from)])
+        return false;
+
+    if (move->flags & BIT_PROMOTION) {
+        // any piece but a pawn, the promoted type is taken from the scan
+        if ((_NONE == PIECE_TYPE(piece)) || (PAWN == PIECE_TYPE(piece)))
+            return false;
+    } else if (piece != move->piece) {
+        return false;
+    }
+
+    if (move->flags & BIT_EP_CAPTURE) {
+        return (0 == scan[SQUARE_TO_IDX(move->to - PIECE_OFFSETS[us][0])]);
+    }
+
+    return true;
+}
+
+bool find_move(game_st *p_game /*board*/, const move_list_st *list /*moves list*/, const uint8_t *scan /*input or desired raw position*/, move_st *p_move /*found move*/)
 {
     bool found = false;
 
     if ((NULL != p_game) && (NULL != list) && (NULL != scan) && (NULL != p_move))
     {
-        uint8_t *board = p_game->board;
-        move_st *elt;
-        LL_FOREACH(list, elt) {
-
-            bool different = false;
-            make_move(p_game, elt);
-            for (uint8_t idx = 0; idx < 64; idx++) {
-                uint8_t sq = IDX_TO_SQUARE(idx);
-                if (scan[idx] == board[sq]) {
-                    // same
-                } else if ((elt->flags & BIT_PROMOTION) && (sq == elt->to) &&
-                           (_NONE != PIECE_TYPE(scan[idx])) && (PAWN != PIECE_TYPE(scan[idx]))) {
-                    //LOGD("promote at %c%u %02x %02x", ALGEBRAIC(sq), scan[idx], board[sq]);
-                } else {
-                    //LOGD("different at %c%u %02x %02x (%02x)", ALGEBRAIC(sq), scan[idx], board[sq], elt->flags);
-                    different = true;
-                    break;
-                }
-            }
-            undo_move(p_game);
+        uint64_t changed = changed_squares(p_game, scan);
+        uint8_t  count = __builtin_popcountll(changed);
+
+        if ((count < 2) || (count > 4))
+            return false;
 
-            if (!different) {
+        /* every other square equals the board, only the signature is compared */
+        const move_st *elt;
+        MOVES_FOREACH(list, elt) {
+            if ((changed == move_signature(p_game, elt)) && scan_matches(p_game, elt, scan)) {
                 //LOGD("found move %c %c%u-%c%u (%02x)", elt->piece, ALGEBRAIC(elt->from), ALGEBRAIC(elt->to), elt->flags);
                 memcpy(p_move, elt, sizeof(move_st));
                 found = true;
@@ -481,61 +1318,77 @@ bool find_move(game_st *p_game /*board*/, move_st *list /*moves list*/, const ui
     return found;
 }
 
-uint8_t hint_moves(game_st *p_game /*board*/, move_st *list /*moves list*/, const uint8_t *scan, uint8_t *squares_buf, uint8_t max_count)
+bool hint_moves(game_st *p_game /*board*/, const move_list_st *list /*moves list*/, const uint8_t *scan, uint8_t *p_from /*lifted piece*/, uint64_t *p_targets /*BB_SQUARE() bits*/)
 {
-    uint8_t count = 0;
-    uint8_t u8_toggle_idx = 0;
-    uint8_t sq = 0;
+    if ((NULL == p_game) || (NULL == list) || (NULL == scan) || (NULL == p_from) || (NULL == p_targets))
+        return false;
 
-    if ((NULL != p_game) && (NULL != list) && (NULL != scan) && (NULL != squares_buf))
-    {
-        for (uint8_t idx = 0; idx < 64; idx++) {
-            sq = IDX_TO_SQUARE(idx);
-            if (p_game->board[sq] != scan[idx]) {
-                //LOGD("different at %c%u %02x %02x", ALGEBRAIC(sq), scan[idx], p_game->board[sq]);
-                count++;
-                u8_toggle_idx = idx;
-            }
-        }
+    uint64_t changed = changed_squares(p_game, scan);
+    if (0 == changed)
+        return false;
 
-        if (1 != count) {
-            // too many changes
-            count = 0;
-        } else if (0 != scan[u8_toggle_idx]) {
-            sq = IDX_TO_SQUARE(u8_toggle_idx);
-            LOGD("new piece %c on %c%u", scan[u8_toggle_idx], ALGEBRAIC(sq));
-            count = 0;
-        } else {
-            uint8_t rank = u8_toggle_idx >> 3;
-            uint8_t file = u8_toggle_idx & 7;
-            uint8_t from = ((7 - rank) << 4) + file;
-
-            count = 0;
-            squares_buf[count++] = from;
-            move_st *elt;
-            LL_FOREACH(list, elt) {
-                if ((elt->from == from) && (count < max_count)) {
-                    squares_buf[count++] = elt->to;
-                }
-            }
+    uint8_t a = __builtin_ctzll(changed);
+    uint8_t b = 63 - __builtin_clzll(changed);
+    uint8_t count = __builtin_popcountll(changed);
+
+    if ((count > 2) || (0 != scan[a]) || (0 != scan[b])) {
+        if ((1 == count) && (0 != scan[a])) {
+            LOGD("new piece %c on %c%u", scan[a], ALGEBRAIC(IDX_TO_SQUARE(a)));
         }
+        return false;
+    }
 
+    if (1 == count) {
+        // lifted piece, its targets (none for the other side)
+        *p_from = IDX_TO_SQUARE(a);
+        *p_targets = MOVE_TARGETS(list, *p_from);
+    } else if (MOVE_TARGETS(list, IDX_TO_SQUARE(a)) & (1ULL << b)) {
+        // piece and the one it captures both lifted
+        *p_from = IDX_TO_SQUARE(a);
+        *p_targets = 1ULL << b;
+    } else if (MOVE_TARGETS(list, IDX_TO_SQUARE(b)) & (1ULL << a)) {
+        *p_from = IDX_TO_SQUARE(b);
+        *p_targets = 1ULL << a;
+    } else {
+        return false;
     }
 
-    return count;
+    return true;
 }
 
-void clear_moves(move_st **plist)
+uint32_t perft(game_st *p_game, uint8_t depth)
 {
-    if ((NULL != plist) && (NULL != *plist))
+    static const uint8_t PROMOTIONS[] = { QUEEN, ROOK, BISHOP, KNIGHT };
+    move_list_st list; // note: 1832 B of stack per depth, only the host tests call it
+    uint32_t nodes = 0;
+
+    if (0 == depth)
+        return 1;
+
+    generate_moves(p_game, &list);
+
+    for (uint8_t i = 0; i < list.count; i++)
     {
-        move_st *elt, *tmp;
-        LL_FOREACH_SAFE(*plist, elt, tmp) {
-            //LOGD("del %02x from %d to %d", elt->piece, elt->from, elt->to);
-            LL_DELETE(*plist, elt);
-            free(elt);
+        move_st *move = &list.moves[i];
+        uint8_t promotions = (move->flags & BIT_PROMOTION) ? sizeof(PROMOTIONS) : 1;
+
+        for (uint8_t j = 0; j < promotions; j++)
+        {
+            if (move->flags & BIT_PROMOTION) {
+                move->promoted = PROMOTIONS[j];
+            }
+
+            if (1 == depth) {
+                nodes++; // bulk count
+            } else {
+                make_move(p_game, move);
+                nodes += perft(p_game, depth - 1);
+                undo_move(p_game);
+            }
         }
     }
+
+    return nodes;
 }
 
 } // namespace chess
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+
+#include "chess.h"
+#include "chess_priv.h"
+
+
+namespace chess
+{
+
+/* 16-bit move: from and to scan indexes, PIECE_INT() of the promoted piece,
+   castling bit (a king move may have the same squares in chess960) */
+#define PACK_MOVE(move)                 (SQUARE_TO_IDX((move)->from) | (SQUARE_TO_IDX((move)->to) << 6) | \
+                                         (((move)->flags & BIT_PROMOTION) ? (PIECE_INT((move)->promoted) << 12) : 0) | \
+                                         (((move)->flags & BITS_CASTLE) ? PACKED_CASTLE : 0))
+#define PACKED_CASTLE                   (1 << 15)
+#define PACKED_FROM(packed)             IDX_TO_SQUARE((packed) & 0x3F)
+#define PACKED_TO(packed)               IDX_TO_SQUARE(((packed) >> 6) & 0x3F)
+#define PACKED_PROMOTED(packed)         (PIECE_TYPES[((packed) >> 12) & 7])
+
+static const uint8_t PIECE_TYPES[] = { _NONE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING }; // by PIECE_INT()
+static const char   *TAG_NAMES[PGN_TAG_COUNT] = { "Event", "Site", "Date", "Round", "White", "Black" };
+
+typedef enum {
+    READ_TAGS = 0,              // one step per pgn_tag_et
+    READ_RESULT_TAG = PGN_TAG_COUNT,
+    READ_SETUP,                 // FEN tag if not the standard start, end of tags
+    READ_MOVES,
+    READ_RESULT,
+    READ_DONE
+} read_step_et;
+
+static void free_chunks(pgn_st *pgn)
+{
+    while (NULL != pgn->chunks) {
+        pgn_chunk_st *next = pgn->chunks->next;
+        free(pgn->chunks);
+        pgn->chunks = next;
+    }
+}
+
+static uint16_t packed_move(const pgn_st *pgn, uint16_t ply)
+{
+    const pgn_chunk_st *chunk = pgn->chunks;
+
+    for (uint16_t n = ply / PGN_CHUNK_PLIES; (n > 0) && (NULL != chunk); n--) {
+        chunk = chunk->next;
+    }
+
+    return chunk ? chunk->moves[ply % PGN_CHUNK_PLIES] : 0;
+}
+
+static const char *result_token(const pgn_st *pgn)
+{
+    if (RESULT_CHECKMATE == pgn->result) {
+        // the side to move after the last ply is mated
+        uint8_t mated = (pgn->plies & 1) ? (uint8_t)SWAP_COLOR(pgn->stats.turn) : pgn->stats.turn;
+        return (WHITE == mated) ? "0-1" : "1-0";
+    }
+
+    // a draw that is only claimable leaves the game going on
+    return ((RESULT_NONE == pgn->result) || (pgn->result >= RESULT_FIFTY_MOVES)) ? "*" : "1/2-1/2";
+}
+
+void pgn_init(pgn_st *pgn, const game_st *p_game)
+{
+    free_chunks(pgn);
+
+    for (uint8_t idx = 0; idx < 64; idx++) {
+        pgn->board[idx] = p_game->board[IDX_TO_SQUARE(idx)];
+    }
+    memcpy(&pgn->stats, &p_game->stats, sizeof(stats_st));
+    pgn->result = RESULT_NONE;
+    pgn->plies  = 0;
+}
+
+void pgn_clear(pgn_st *pgn)
+{
+    free_chunks(pgn);
+    memset(pgn, 0, sizeof(pgn_st));
+}
+
+bool pgn_append(pgn_st *pgn, const move_st *move)
+{
+    pgn_chunk_st **link = &pgn->chunks;
+
+    for (uint16_t n = pgn->plies / PGN_CHUNK_PLIES; ; n--) {
+        if ((NULL == *link) && (NULL == (*link = (pgn_chunk_st *)calloc(1, sizeof(pgn_chunk_st))))) {
+            LOGW("ply %u not recorded", pgn->plies + 1);
+            return false;
+        }
+        if (0 == n)
+            break;
+        link = &(*link)->next;
+    }
+
+    (*link)->moves[pgn->plies % PGN_CHUNK_PLIES] = PACK_MOVE(move);
+    pgn->plies++;
+
+    return true;
+}
+
+void pgn_truncate(pgn_st *pgn, uint16_t plies)
+{
+    if (plies < pgn->plies) {
+        pgn->plies  = plies;
+        pgn->result = RESULT_NONE;
+    }
+}
+
+void pgn_set_tag(pgn_st *pgn, uint8_t tag, const char *value)
+{
+    if (tag < PGN_TAG_COUNT) {
+        strncpy(pgn->tags[tag], value ? value : "", PGN_TAG_LEN - 1);
+    }
+}
+
+/* replay the next ply, optionally rendering its SAN with check suffix */
+static bool next_move(pgn_reader_st *reader, char *san, uint8_t san_sz)
+{
+    game_st *game = &reader->game;
+    const move_st *elt;
+    move_st move;
+
+    if (reader->ply >= reader->pgn->plies)
+        return false;
+
+    uint16_t packed = packed_move(reader->pgn, reader->ply);
+    MOVES_FOREACH(&reader->list, elt) {
+        if ((elt->from == PACKED_FROM(packed)) && (elt->to == PACKED_TO(packed)) &&
+            ((0 != (elt->flags & BITS_CASTLE)) == (0 != (packed & PACKED_CASTLE))))
+            break;
+    }
+    if (elt == (reader->list.moves + reader->list.count)) {
+        LOGW("ply %u %c%u%c%u not legal", reader->ply + 1, ALGEBRAIC(PACKED_FROM(packed)), ALGEBRAIC(PACKED_TO(packed)));
+        return false;
+    }
+
+    memcpy(&move, elt, sizeof(move_st));
+    if (move.flags & BIT_PROMOTION) {
+        move.promoted = PACKED_PROMOTED(packed);
+    }
+
+    if (NULL != san) {
+        memset(san, 0, san_sz);
+        move_to_san(&reader->list, &move, san, san_sz - 2);
+    }
+
+    make_move(game, &move);
+    uint8_t count = generate_moves(game, &reader->list);
+    if ((NULL != san) && IN_CHECK(game)) {
+        strcat(san, count ? "+" : "#");
+    }
+    reader->ply++;
+
+    return true;
+}
+
+/* render the next token into reader->text, false once everything was read */
+static bool next_token(pgn_reader_st *reader)
+{
+    const pgn_st *pgn = reader->pgn;
+    const stats_st *stats = &reader->game.stats;
+    char *text = reader->text;
+    int len = 0;
+
+    while ((0 == len) && (READ_DONE != reader->step))
+    {
+        if (reader->step < READ_RESULT_TAG) {
+            len = snprintf(text, PGN_TOKEN_LEN, "[%s \"%s\"]\n", TAG_NAMES[reader->step],
+                           pgn->tags[reader->step][0] ? pgn->tags[reader->step] : "?");
+            reader->step++;
+        }
+        else if (READ_RESULT_TAG == reader->step) {
+            len = snprintf(text, PGN_TOKEN_LEN, "[Result \"%s\"]\n", result_token(pgn));
+            reader->step++;
+        }
+        else if (READ_SETUP == reader->step) {
+            char fen[FEN_BUFF_LEN];
+            if (0 != strcmp(START_FEN, generate_fen(&reader->game, fen))) {
+                len = snprintf(text, PGN_TOKEN_LEN, "%s[SetUp \"1\"]\n[FEN \"%s\"]\n\n",
+                               chess960_position(&reader->game) ? "[Variant \"Chess960\"]\n" : "", fen);
+            } else {
+                len = snprintf(text, PGN_TOKEN_LEN, "\n");
+            }
+            reader->step++;
+        }
+        else if (READ_MOVES == reader->step) {
+            char san[16];
+            uint16_t move_number = stats->move_number;
+            bool b_white = (WHITE == stats->turn);
+            if (next_move(reader, san, sizeof(san))) {
+                if (b_white) {
+                    len = snprintf(text, PGN_TOKEN_LEN, "%u. %s ", move_number, san);
+                } else if (reader->b_first) {
+                    len = snprintf(text, PGN_TOKEN_LEN, "%u... %s ", move_number, san);
+                } else {
+                    len = snprintf(text, PGN_TOKEN_LEN, "%s ", san);
+                }
+                reader->b_first = false;
+            } else {
+                reader->step++;
+            }
+        }
+        else if (READ_RESULT == reader->step) {
+            // movetext only exports leave an ongoing game open
+            if (reader->b_tags || (RESULT_NONE != pgn->result)) {
+                len = snprintf(text, PGN_TOKEN_LEN, "%s\n", result_token(pgn));
+            }
+            reader->step++;
+        }
+    }
+
+    reader->pending = (len > 0) ? len : 0;
+    return (len > 0);
+}
+
+bool pgn_open(pgn_reader_st *reader, const pgn_st *pgn, uint16_t from_ply, bool b_tags)
+{
+    game_st *game = &reader->game;
+
+    init_game(game);
+    for (uint8_t idx = 0; idx < 64; idx++) {
+        game->board[IDX_TO_SQUARE(idx)] = pgn->board[idx];
+    }
+    memcpy(&game->stats, &pgn->stats, sizeof(stats_st));
+    if (!index_position(game))
+        return false;
+    generate_moves(game, &reader->list);
+
+    reader->pgn     = pgn;
+    reader->ply     = 0;
+    reader->pending = 0;
+    reader->b_tags  = b_tags;
+    reader->b_first = true;
+    reader->step    = b_tags ? READ_TAGS : READ_MOVES;
+
+    // the tags describe the whole game
+    while (!b_tags && (reader->ply < from_ply)) {
+        if (!next_move(reader, NULL, 0))
+            break;
+    }
+
+    return true;
+}
+
+uint16_t pgn_read(pgn_reader_st *reader, char *buf, uint16_t buf_sz)
+{
+    uint16_t len = 0;
+
+    while ((0 != reader->pending) || next_token(reader)) {
+        if (len + reader->pending > buf_sz)
+            break; // keep for the next read
+        memcpy(buf + len, reader->text, reader->pending);
+        len += reader->pending;
+        reader->pending = 0;
+    }
+
+    return len;
+}
+
+} // namespace chess
@@ -1,21 +1,138 @@
 
 #pragma once
 
+#if defined(ESP_PLATFORM)
+#include "globals.h"
+#else // host build of the chess core (no FreeRTOS/esp-idf)
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#define millis()                        ((uint32_t)(clock() / (CLOCKS_PER_SEC / 1000)))
+#define LOGD(fmt, ...)                  printf("D " fmt "\n", ## __VA_ARGS__)
+#define LOGI(fmt, ...)                  printf("I " fmt "\n", ## __VA_ARGS__)
+#define LOGW(fmt, ...)                  printf("W " fmt "\n", ## __VA_ARGS__)
+#define LOGE(fmt, ...)                  printf("E " fmt "\n", ## __VA_ARGS__)
+#endif
+
 #include "chess.h"
 
 namespace chess
 {
 
-const uint8_t KINGS[] = { e8, e1 };
+/* 1 = filter pseudo-legal moves with pins/checkers computed once per position,
+   0 = make/undo every pseudo-legal move (reference, for differential testing) */
+#ifndef LEGAL_MOVEGEN
+#define LEGAL_MOVEGEN                   (1)
+#endif
 
-const uint8_t ROOKS[][4] = {
-    { a8, BIT_QSIDE_CASTLE, h8, BIT_KSIDE_CASTLE },
-    { a1, BIT_QSIDE_CASTLE, h1, BIT_KSIDE_CASTLE }
-};
+/* call counters for the host benchmarks */
+#ifndef CHESS_COUNTERS
+#define CHESS_COUNTERS                  (0)
+#endif
+
+#if CHESS_COUNTERS
+typedef struct {
+    uint32_t attacked;
+} counters_st;
+
+extern counters_st bench_counters;
+#define COUNT(name)                     (bench_counters.name++)
+#else
+#define COUNT(name)
+#endif
+
+#if BITBOARDS
+/* bit index = SQUARE_TO_IDX(): a1 = 0, h1 = 7, .. h8 = 63 */
+typedef enum {
+    BB_NORTH, BB_EAST, BB_NORTH_EAST, BB_NORTH_WEST, // increasing index
+    BB_SOUTH, BB_WEST, BB_SOUTH_WEST, BB_SOUTH_EAST  // decreasing index
+} bb_ray_et;
+
+typedef struct {
+    uint64_t knight[64];
+    uint64_t king[64];
+    uint64_t pawn[2][64];   // squares attacked by a pawn of that color
+    uint64_t rays[8][64];   // bb_ray_et, up to the board edge
+} bb_tables_st;
+
+constexpr uint64_t bb_offset(int8_t idx, int8_t file_step, int8_t rank_step)
+{
+    int8_t file = (idx & 7) + file_step;
+    int8_t rank = (idx >> 3) + rank_step;
+    return ((file < 0) || (file > 7) || (rank < 0) || (rank > 7)) ? 0 : (1ULL << ((rank << 3) + file));
+}
+
+constexpr bb_tables_st bb_tables(void)
+{
+    constexpr int8_t KNIGHT_STEPS[8][2] = { {1,2}, {2,1}, {2,-1}, {1,-2}, {-1,-2}, {-2,-1}, {-2,1}, {-1,2} };
+    constexpr int8_t KING_STEPS[8][2]   = { {0,1}, {1,0}, {1,1}, {-1,1}, {0,-1}, {-1,0}, {-1,-1}, {1,-1} }; // bb_ray_et order
+    bb_tables_st tables = {};
+
+    for (int8_t idx = 0; idx < 64; idx++) {
+        for (uint8_t i = 0; i < 8; i++) {
+            tables.knight[idx] |= bb_offset(idx, KNIGHT_STEPS[i][0], KNIGHT_STEPS[i][1]);
+            tables.king[idx]   |= bb_offset(idx, KING_STEPS[i][0], KING_STEPS[i][1]);
+            for (int8_t n = 1; n < 8; n++) {
+                tables.rays[i][idx] |= bb_offset(idx, n * KING_STEPS[i][0], n * KING_STEPS[i][1]);
+            }
+        }
+        tables.pawn[WHITE][idx] = bb_offset(idx, -1,  1) | bb_offset(idx, 1,  1);
+        tables.pawn[BLACK][idx] = bb_offset(idx, -1, -1) | bb_offset(idx, 1, -1);
+    }
+
+    return tables;
+}
+
+constexpr bb_tables_st BB_TABLES = bb_tables();
+
+static_assert(BB_TABLES.knight[0] == ((1ULL << 10) | (1ULL << 17)), "knight a1");
+static_assert(BB_TABLES.king[63] == ((1ULL << 62) | (1ULL << 55) | (1ULL << 54)), "king h8");
+static_assert(BB_TABLES.rays[BB_NORTH_EAST][0] == 0x8040201008040200ULL, "a1-h8 diagonal");
+#endif
+
+/* zobrist keys, polyglot layout: 64 * (2 * (PIECE_INT() - 1) + color) + SQUARE_TO_IDX() */
+#define ZOBRIST_PIECE(u8_piece, sq)     (64 * (2 * (PIECE_INT(PIECE_TYPE(u8_piece)) - 1) + PIECE_COLOR(u8_piece)) + SQUARE_TO_IDX(sq))
+#define ZOBRIST_CASTLING                (768) // white short, white long, black short, black long
+#define ZOBRIST_EP_FILE                 (772) // a .. h
+#define ZOBRIST_TURN                    (780) // white to move
+#define ZOBRIST_KEYS                    (781)
+
+typedef struct {
+    uint64_t keys[ZOBRIST_KEYS];
+} zobrist_st;
+
+constexpr zobrist_st zobrist_keys(void)
+{
+    zobrist_st zobrist = {};
+    uint64_t seed = 0x45534233324348ULL;
+
+    for (uint16_t i = 0; i < ZOBRIST_KEYS; i++) {
+        /* splitmix64 */
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        zobrist.keys[i] = z ^ (z >> 31);
+    }
+
+    return zobrist;
+}
+
+constexpr zobrist_st ZOBRIST = zobrist_keys();
+
+/* castling by side, 0 = queen side, 1 = king side: the king lands on the c or g file,
+   the rook next to it on the d or f file, whatever files they start from (chess960) */
+const uint8_t CASTLE_FLAGS[] = { BIT_QSIDE_CASTLE, BIT_KSIDE_CASTLE };
+const uint8_t CASTLED_KING[] = { 2, 6 };
+const uint8_t CASTLED_ROOK[] = { 3, 5 };
+
+const uint8_t BACK_RANK[] = { a8, a1 };
+
+#define CASTLE_SIDE(flags)              (((flags) & BIT_KSIDE_CASTLE) ? 1 : 0)
+#define CASTLING_ROOK(stats, color, side) (BACK_RANK[color] + (stats)->castling_rooks[color][side])
 
 const uint8_t SECOND_RANK[] = { RANK_7, RANK_2 };
 
-const uint8_t SHIFTS[] = {
+constexpr uint8_t SHIFTS[] = {
     /*p*/ 0, // black
     /*p*/ 0, // white
     /*n*/ 1,
@@ -25,7 +142,7 @@ const uint8_t SHIFTS[] = {
     /*k*/ 5
 };
 
-const int8_t PIECE_OFFSETS[][8] = {
+constexpr int8_t PIECE_OFFSETS[][8] = {
     /*p*/{  16,  32,  17,  15,   0,  0,  0,  0 }, // black pawn
     /*p*/{ -16, -32, -17, -15,   0,  0,  0,  0 }, // white pawn
     /*n*/{ -18, -33, -31, -14,  18, 33, 31, 14 },
@@ -35,7 +152,8 @@ const int8_t PIECE_OFFSETS[][8] = {
     /*k*/{ -17, -16, -15,   1,  17, 16, 15, -1 }
 };
 
-const int8_t ATTACKS[] = {
+/* original hand-typed tables, only kept to check the generated ones below */
+constexpr int8_t ATTACKS_LITERAL[] = {
     20, 0, 0, 0, 0, 0, 0, 24,  0, 0, 0, 0, 0, 0,20, 0,
      0,20, 0, 0, 0, 0, 0, 24,  0, 0, 0, 0, 0,20, 0, 0,
      0, 0,20, 0, 0, 0, 0, 24,  0, 0, 0, 0,20, 0, 0, 0,
@@ -53,7 +171,7 @@ const int8_t ATTACKS[] = {
     20, 0, 0, 0, 0, 0, 0, 24,  0, 0, 0, 0, 0, 0,20
 };
 
-const int8_t RAYS[] = {
+constexpr int8_t RAYS_LITERAL[] = {
     17,  0,  0,  0,  0,  0,  0, 16,  0,  0,  0,  0,  0,  0, 15, 0,
      0, 17,  0,  0,  0,  0,  0, 16,  0,  0,  0,  0,  0, 15,  0, 0,
      0,  0, 17,  0,  0,  0,  0, 16,  0,  0,  0,  0, 15,  0,  0, 0,
@@ -71,4 +189,46 @@ const int8_t RAYS[] = {
    -15,  0,  0,  0,  0,  0,  0,-16,  0,  0,  0,  0,  0,  0,-17
 };
 
+/* indexed by (attacker - target) + h1 */
+typedef struct {
+    int8_t attacks[2 * h1 + 1]; // 1 << SHIFTS[] of the pieces that can attack along that difference
+    int8_t rays[2 * h1 + 1];    // step from attacker toward target, sliders only
+} ray_tables_st;
+
+constexpr ray_tables_st ray_tables(void)
+{
+    ray_tables_st tables = {};
+
+    for (uint8_t p = 0; p < sizeof(SHIFTS); p++) {
+        bool slider = (PIECE_INT(BISHOP) <= p) && (p <= PIECE_INT(QUEEN));
+        for (uint8_t j = (p <= PIECE_INT(PAWN)) ? 2 /*captures only*/ : 0; j < 8; j++) {
+            int8_t offset = PIECE_OFFSETS[p][j];
+            for (int8_t n = 1; (0 != offset) && (n <= (slider ? 7 : 1)); n++) {
+                int16_t index = h1 - (offset * n);
+                tables.attacks[index] |= (1 << SHIFTS[p]);
+                if (slider) {
+                    tables.rays[index] = offset;
+                }
+            }
+        }
+    }
+
+    return tables;
+}
+
+constexpr ray_tables_st RAY_TABLES = ray_tables();
+static constexpr const int8_t (&ATTACKS)[sizeof(RAY_TABLES.attacks)] = RAY_TABLES.attacks;
+static constexpr const int8_t (&RAYS)[sizeof(RAY_TABLES.rays)] = RAY_TABLES.rays;
+
+constexpr bool same_table(const int8_t *a, const int8_t *b, uint16_t size)
+{
+    for (uint16_t i = 0; i < size; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+static_assert(same_table(ATTACKS, ATTACKS_LITERAL, sizeof(ATTACKS_LITERAL)) && (sizeof(ATTACKS) == sizeof(ATTACKS_LITERAL)), "ATTACKS");
+static_assert(same_table(RAYS, RAYS_LITERAL, sizeof(RAYS_LITERAL)) && (sizeof(RAYS) == sizeof(RAYS_LITERAL)), "RAYS");
+
 } // namespace chess
@@ -0,0 +1,453 @@
+#include <stdlib.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_heap_caps.h>
+#endif
+
+#include "chess.h"
+#include "chess_priv.h"
+
+
+namespace chess
+{
+
+#define SEARCH_INFINITE                 (32000)
+#define SEARCH_CHECK_NODES              (1024) // nodes between clock reads
+#define SEARCH_MIN_TT_BITS              (10)   // 1k entries, 12 kB, the only size taken from internal ram
+#define SEARCH_INTERNAL_RESERVE         (64 * 1024) // internal ram left to wifi and TLS
+
+typedef enum {
+    TT_NONE = 0,
+    TT_EXACT,
+    TT_LOWER,                   // fail high, score is a lower bound
+    TT_UPPER                    // fail low, score is an upper bound
+} tt_bound_et;
+
+typedef struct {
+    uint32_t check;             // upper half of the key
+    uint16_t move;              // from | to << 8, 0x80 if castling (chess960), 0 if none
+    int16_t  score;             // mates relative to this node
+    uint8_t  depth;
+    uint8_t  bound;             // tt_bound_et
+} tt_entry_st;
+
+/* preallocated once: per-ply move lists and ordering, then the transposition table */
+typedef struct {
+    move_list_st lists[SEARCH_MAX_PLY];
+    int16_t      order[SEARCH_MAX_PLY][MAX_MOVES];
+    uint16_t     killers[SEARCH_MAX_PLY][2];
+    tt_entry_st  tt[];
+} search_arena_st;
+
+static struct {
+    search_arena_st *arena;
+    uint32_t      tt_mask;
+    uint32_t      nodes;
+    uint32_t      ms_start;
+    uint32_t      ms_budget;
+    bool          b_abort;
+    volatile bool b_stop;       // set from another task
+} s_search;
+
+static const int16_t PIECE_VALUES[] = { 0, 100, 320, 330, 500, 900, 0 }; // by PIECE_INT()
+static const uint8_t PIECE_PHASES[] = { 0, 0, 1, 1, 2, 4, 0 };
+#define PHASE_MAX                       (24) // all minor and major pieces on board
+
+/* piece-square tables from white's side, rank 8 first, by PIECE_INT() - 1 then the king endgame */
+static const int8_t PST[7][64] = {
+    { // pawn
+         0,  0,  0,  0,  0,  0,  0,  0,
+        50, 50, 50, 50, 50, 50, 50, 50,
+        10, 10, 20, 30, 30, 20, 10, 10,
+         5,  5, 10, 25, 25, 10,  5,  5,
+         0,  0,  0, 20, 20,  0,  0,  0,
+         5, -5,-10,  0,  0,-10, -5,  5,
+         5, 10, 10,-20,-20, 10, 10,  5,
+         0,  0,  0,  0,  0,  0,  0,  0
+    },
+    { // knight
+       -50,-40,-30,-30,-30,-30,-40,-50,
+       -40,-20,  0,  0,  0,  0,-20,-40,
+       -30,  0, 10, 15, 15, 10,  0,-30,
+       -30,  5, 15, 20, 20, 15,  5,-30,
+       -30,  0, 15, 20, 20, 15,  0,-30,
+       -30,  5, 10, 15, 15, 10,  5,-30,
+       -40,-20,  0,  5,  5,  0,-20,-40,
+       -50,-40,-30,-30,-30,-30,-40,-50
+    },
+    { // bishop
+       -20,-10,-10,-10,-10,-10,-10,-20,
+       -10,  0,  0,  0,  0,  0,  0,-10,
+       -10,  0,  5, 10, 10,  5,  0,-10,
+       -10,  5,  5, 10, 10,  5,  5,-10,
+       -10,  0, 10, 10, 10, 10,  0,-10,
+       -10, 10, 10, 10, 10, 10, 10,-10,
+       -10,  5,  0,  0,  0,  0,  5,-10,
+       -20,-10,-10,-10,-10,-10,-10,-20
+    },
+    { // rook
+         0,  0,  0,  0,  0,  0,  0,  0,
+         5, 10, 10, 10, 10, 10, 10,  5,
+        -5,  0,  0,  0,  0,  0,  0, -5,
+        -5,  0,  0,  0,  0,  0,  0, -5,
+        -5,  0,  0,  0,  0,  0,  0, -5,
+        -5,  0,  0,  0,  0,  0,  0, -5,
+        -5,  0,  0,  0,  0,  0,  0, -5,
+         0,  0,  0,  5,  5,  0,  0,  0
+    },
+    { // queen
+       -20,-10,-10, -5, -5,-10,-10,-20,
+       -10,  0,  0,  0,  0,  0,  0,-10,
+       -10,  0,  5,  5,  5,  5,  0,-10,
+        -5,  0,  5,  5,  5,  5,  0, -5,
+         0,  0,  5,  5,  5,  5,  0, -5,
+       -10,  5,  5,  5,  5,  5,  0,-10,
+       -10,  0,  5,  0,  0,  0,  0,-10,
+       -20,-10,-10, -5, -5,-10,-10,-20
+    },
+    { // king, middle game
+       -30,-40,-40,-50,-50,-40,-40,-30,
+       -30,-40,-40,-50,-50,-40,-40,-30,
+       -30,-40,-40,-50,-50,-40,-40,-30,
+       -30,-40,-40,-50,-50,-40,-40,-30,
+       -20,-30,-30,-40,-40,-30,-30,-20,
+       -10,-20,-20,-20,-20,-20,-20,-10,
+        20, 20,  0,  0,  0,  0, 20, 20,
+        20, 30, 10,  0,  0, 10, 30, 20
+    },
+    { // king, end game
+       -50,-40,-30,-20,-20,-30,-40,-50,
+       -30,-20,-10,  0,  0,-10,-20,-30,
+       -30,-10, 20, 30, 30, 20,-10,-30,
+       -30,-10, 30, 40, 40, 30,-10,-30,
+       -30,-10, 30, 40, 40, 30,-10,-30,
+       -30,-10, 20, 30, 30, 20,-10,-30,
+       -30,-30,  0,  0,  0,  0,-30,-30,
+       -50,-30,-30,-30,-30,-30,-30,-50
+    }
+};
+
+#define PST_INDEX(color, sq)            ((((WHITE == (color)) ? RANK(sq) : (7 - RANK(sq))) << 3) + FILE(sq))
+#define PACK_TT_MOVE(move)              ((move)->from | ((move)->to << 8) | (((move)->flags & BITS_CASTLE) ? 0x80 : 0))
+#define IS_MATE_SCORE(score)            (abs(score) > (SEARCH_MATE - SEARCH_MAX_PLY))
+
+bool search_init(uint8_t tt_bits)
+{
+    if (NULL != s_search.arena)
+        return true;
+
+    /* psram when fitted, halving the table until one fits */
+    size_t size = 0;
+    for (; tt_bits >= SEARCH_MIN_TT_BITS; tt_bits--)
+    {
+        size = sizeof(search_arena_st) + (sizeof(tt_entry_st) << tt_bits);
+#if defined(ESP_PLATFORM)
+        s_search.arena = (search_arena_st *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#else
+        s_search.arena = (search_arena_st *)malloc(size);
+#endif
+        if (NULL != s_search.arena)
+            break;
+    }
+
+#if defined(ESP_PLATFORM)
+    /* no psram: the smallest table from internal ram, only if wifi and TLS keep their share */
+    if (NULL == s_search.arena)
+    {
+        tt_bits = SEARCH_MIN_TT_BITS;
+        size = sizeof(search_arena_st) + (sizeof(tt_entry_st) << tt_bits);
+        if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) >= size + SEARCH_INTERNAL_RESERVE)
+            s_search.arena = (search_arena_st *)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+#endif
+
+    if (NULL == s_search.arena) {
+        LOGE("no search arena, %u bytes", (unsigned)size);
+        return false;
+    }
+
+    memset(s_search.arena, 0, size);
+    s_search.tt_mask = (1UL << tt_bits) - 1;
+    LOGI("search arena %u kB, %lu tt entries", (unsigned)(size >> 10), (unsigned long)(s_search.tt_mask + 1));
+    return true;
+}
+
+void search_stop(void)
+{
+    s_search.b_stop = true;
+}
+
+int16_t evaluate(const game_st *p_game)
+{
+    int16_t score[2] = { 0, 0 };
+    int16_t king[2][2] = { { 0, 0 }, { 0, 0 } }; // middle and end game
+    uint8_t phase = 0;
+
+    for (uint8_t color = BLACK; color <= WHITE; color++) {
+        for (uint8_t n = 0; n < p_game->piece_count[color]; n++) {
+            uint8_t sq = p_game->pieces[color][n];
+            uint8_t idx = PIECE_INT(PIECE_TYPE(p_game->board[sq]));
+            if (PIECE_INT(KING) == idx) {
+                king[color][0] = PST[idx - 1][PST_INDEX(color, sq)];
+                king[color][1] = PST[idx][PST_INDEX(color, sq)];
+            } else {
+                score[color] += PIECE_VALUES[idx] + PST[idx - 1][PST_INDEX(color, sq)];
+                phase += PIECE_PHASES[idx];
+            }
+        }
+    }
+
+    /* kings taper from the middle to the end game table as pieces come off */
+    if (phase > PHASE_MAX)
+        phase = PHASE_MAX;
+    for (uint8_t color = BLACK; color <= WHITE; color++) {
+        score[color] += (king[color][0] * phase + king[color][1] * (PHASE_MAX - phase)) / PHASE_MAX;
+    }
+
+    uint8_t us = p_game->stats.turn;
+    return score[us] - score[SWAP_COLOR(us)];
+}
+
+static inline bool out_of_time(void)
+{
+    if (0 == (++s_search.nodes % SEARCH_CHECK_NODES)) {
+        if (s_search.b_stop || (millis() - s_search.ms_start >= s_search.ms_budget))
+            s_search.b_abort = true;
+    }
+    return s_search.b_abort;
+}
+
+/* mate scores are stored relative to the node, returned relative to the root */
+static inline int16_t score_to_tt(int16_t score, uint8_t ply)
+{
+    return IS_MATE_SCORE(score) ? ((score > 0) ? score + ply : score - ply) : score;
+}
+
+static inline int16_t score_from_tt(int16_t score, uint8_t ply)
+{
+    return IS_MATE_SCORE(score) ? ((score > 0) ? score - ply : score + ply) : score;
+}
+
+/* captures by MVV-LVA, then promotions, the transposition table move first and killers after */
+static void order_moves(const move_list_st *list, int16_t *order, uint16_t tt_move, uint8_t ply)
+{
+    const uint16_t *killers = s_search.arena->killers[ply];
+
+    for (uint8_t i = 0; i < list->count; i++) {
+        const move_st *move = &list->moves[i];
+        uint16_t packed = PACK_TT_MOVE(move);
+        int16_t  value = 0;
+
+        if (packed == tt_move) {
+            value = 30000;
+        } else if (move->captured) {
+            value = 20000 + 16 * PIECE_INT(PIECE_TYPE(move->captured)) - PIECE_INT(PIECE_TYPE(move->piece));
+        } else if (move->flags & BIT_PROMOTION) {
+            value = 19000;
+        } else if (packed == killers[0]) {
+            value = 18000;
+        } else if (packed == killers[1]) {
+            value = 17000;
+        }
+        order[i] = value;
+    }
+}
+
+/* swap the best ordered move of the remaining ones into place */
+static inline move_st *pick_move(move_list_st *list, int16_t *order, uint8_t i)
+{
+    uint8_t best = i;
+
+    for (uint8_t j = i + 1; j < list->count; j++) {
+        if (order[j] > order[best])
+            best = j;
+    }
+    if (best != i) {
+        move_st move = list->moves[i];
+        int16_t value = order[i];
+        list->moves[i] = list->moves[best];
+        order[i] = order[best];
+        list->moves[best] = move;
+        order[best] = value;
+    }
+
+    return &list->moves[i];
+}
+
+static int16_t quiesce(game_st *p_game, int16_t alpha, int16_t beta, uint8_t ply)
+{
+    if (out_of_time())
+        return 0;
+
+    bool b_check = IN_CHECK(p_game);
+    int16_t best = -SEARCH_INFINITE;
+
+    /* standing pat, unless every move has to be looked at to get out of check */
+    if (!b_check) {
+        best = evaluate(p_game);
+        if ((best >= beta) || (ply >= SEARCH_MAX_PLY))
+            return best;
+        if (best > alpha)
+            alpha = best;
+    }
+    if (ply >= SEARCH_MAX_PLY)
+        return alpha;
+
+    move_list_st *list = &s_search.arena->lists[ply];
+    int16_t *order = s_search.arena->order[ply];
+    if (0 == generate_moves(p_game, list))
+        return b_check ? -(SEARCH_MATE - ply) : 0;
+    order_moves(list, order, 0, ply);
+
+    for (uint8_t i = 0; i < list->count; i++) {
+        move_st *move = pick_move(list, order, i);
+        if (!b_check && !move->captured && !(move->flags & BIT_PROMOTION))
+            break; // ordered, no captures left
+
+        make_move(p_game, move);
+        int16_t score = -quiesce(p_game, -beta, -alpha, ply + 1);
+        undo_move(p_game);
+        if (s_search.b_abort)
+            return 0;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (score >= beta)
+                    break;
+            }
+        }
+    }
+
+    return best;
+}
+
+static int16_t alpha_beta(game_st *p_game, int16_t alpha, int16_t beta, uint8_t depth, uint8_t ply, move_st *best_move)
+{
+    if (0 == depth)
+        return quiesce(p_game, alpha, beta, ply);
+    if (out_of_time())
+        return 0;
+
+    if (ply > 0) {
+        if ((p_game->stats.half_moves >= 100) || (repetitions(p_game) >= 2) || insufficient_material(p_game))
+            return 0; // draw
+        if (ply >= SEARCH_MAX_PLY)
+            return evaluate(p_game);
+    }
+
+    /* transposition table */
+    tt_entry_st *entry = &s_search.arena->tt[p_game->stats.key & s_search.tt_mask];
+    uint32_t check = (uint32_t)(p_game->stats.key >> 32);
+    uint16_t tt_move = 0;
+    if ((TT_NONE != entry->bound) && (entry->check == check)) {
+        tt_move = entry->move;
+        if ((ply > 0) && (entry->depth >= depth)) {
+            int16_t score = score_from_tt(entry->score, ply);
+            if ((TT_EXACT == entry->bound) ||
+                ((TT_LOWER == entry->bound) && (score >= beta)) ||
+                ((TT_UPPER == entry->bound) && (score <= alpha)))
+                return score;
+        }
+    }
+
+    move_list_st *list = &s_search.arena->lists[ply];
+    int16_t *order = s_search.arena->order[ply];
+    bool b_check = IN_CHECK(p_game);
+    if (0 == generate_moves(p_game, list))
+        return b_check ? -(SEARCH_MATE - ply) : 0;
+    if (b_check)
+        depth++; // check extension
+    order_moves(list, order, tt_move, ply);
+
+    int16_t  alpha_in = alpha;
+    int16_t  best = -SEARCH_INFINITE;
+    uint16_t best_packed = 0;
+
+    for (uint8_t i = 0; i < list->count; i++) {
+        move_st *move = pick_move(list, order, i);
+        if (move->flags & BIT_PROMOTION)
+            move->promoted = QUEEN; // under-promotions are not searched
+
+        make_move(p_game, move);
+        int16_t score = -alpha_beta(p_game, -beta, -alpha, depth - 1, ply + 1, NULL);
+        undo_move(p_game);
+        if (s_search.b_abort)
+            return 0;
+
+        if (score > best) {
+            best = score;
+            best_packed = PACK_TT_MOVE(move);
+            if (best_move)
+                *best_move = *move;
+            if (score > alpha) {
+                alpha = score;
+                if (score >= beta) {
+                    uint16_t *killers = s_search.arena->killers[ply];
+                    if (!move->captured && (killers[0] != best_packed)) {
+                        killers[1] = killers[0];
+                        killers[0] = best_packed;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    /* always replace, the newer search is the more relevant one */
+    entry->check = check;
+    entry->move  = best_packed;
+    entry->score = score_to_tt(best, ply);
+    entry->depth = depth;
+    entry->bound = (best >= beta) ? TT_LOWER : ((best > alpha_in) ? TT_EXACT : TT_UPPER);
+
+    return best;
+}
+
+bool search(game_st *p_game, uint32_t ms_budget, uint8_t max_depth, search_result_st *result)
+{
+    if ((NULL == s_search.arena) || (NULL == p_game) || (NULL == result))
+        return false;
+
+    memset(result, 0, sizeof(search_result_st));
+    memset(s_search.arena->killers, 0, sizeof(s_search.arena->killers));
+    s_search.nodes     = 0;
+    s_search.ms_start  = millis();
+    s_search.ms_budget = ms_budget;
+    s_search.b_stop    = false;
+
+    if (max_depth >= SEARCH_MAX_PLY)
+        max_depth = SEARCH_MAX_PLY - 1;
+
+    for (uint8_t depth = 1; depth <= max_depth; depth++)
+    {
+        move_st best_move = {};
+
+        s_search.b_abort = false;
+        int16_t score = alpha_beta(p_game, -SEARCH_INFINITE, SEARCH_INFINITE, depth, 0, &best_move);
+        if (s_search.b_abort && (depth > 1))
+            break; // the last complete iteration stands
+
+        result->best  = best_move;
+        result->score = score;
+        result->depth = depth;
+
+        uint32_t ms = millis() - s_search.ms_start;
+        LOGD("depth %u score %d %c%u%c%u, %lu nodes %lu ms", depth, score, ALGEBRAIC(best_move.from), ALGEBRAIC(best_move.to),
+             (unsigned long)s_search.nodes, (unsigned long)ms);
+
+        /* no mate is shorter than the one found, a deeper iteration would not finish in time */
+        if (s_search.b_abort || (0 == best_move.piece) || IS_MATE_SCORE(score) || (2 * ms >= ms_budget))
+            break;
+    }
+
+    result->nodes = s_search.nodes;
+    result->ms    = millis() - s_search.ms_start;
+    LOGI("search depth %u score %d, %lu nodes/s", result->depth, result->score,
+         (unsigned long)(result->nodes * 1000ULL / (result->ms ? result->ms : 1)));
+
+    return (0 != result->best.piece);
+}
+
+} // namespace chess
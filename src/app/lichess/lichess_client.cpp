@@ -21,6 +21,9 @@
 
 #define CLEAR_BOTTOM_MENU()         DISPLAY_CLEAR_ROW(45, 18);
 
+#define OFFLINE_DELAY_MS            (30*1000UL) // without lichess, before offering the engine
+#define OFFLINE_DEFAULT_LEVEL       (3)
+
 namespace lichess
 {
 
@@ -42,6 +45,10 @@ static bool             b_offer_draw = false;
 static bool             b_has_moved = false;
 static bool             b_opponent_changed = false;
 static uint8_t          u8_error_count;
+static uint32_t         ms_offline = 0; // since not connected, 0 if connected
+static uint8_t          u8_offline_level = OFFLINE_DEFAULT_LEVEL;
+static bool             b_offline_game = false;
+static uint32_t         u32_position_seq = 0; // last chess::wait_position()
 
 static enum {
     CLIENT_STATE_INIT,
@@ -50,7 +57,8 @@ static enum {
     CLIENT_STATE_CHECK_GAME,    // check messages from game-state stream
     CLIENT_STATE_CHECK_BOARD,   // get board status
     CLIENT_STATE_GAME_FINISHED, // get board status
-    CLIENT_STATE_IDLE
+    CLIENT_STATE_IDLE,
+    CLIENT_STATE_OFFLINE        // play the on-board engine
 } e_state;
 
 static struct {
@@ -69,6 +77,8 @@ static int poll_events();
 static int poll_game_state();
 static void display_clock(bool b_turn, bool b_show);
 static const char *get_player_name(challenge_st *ps_challenge);
+static void set_pgn_tags(const game_st *ps_game);
+static void play_offline();
 
 
 bool init()
@@ -122,8 +132,21 @@ void loop()
             if (!ac_username[0]) {
                 delayms(3000); // initial delay
             }
+            ms_offline = 0;
             e_state = CLIENT_STATE_GET_ACCOUNT;
         }
+        else if (0 == ms_offline)
+        {
+            ms_offline = millis();
+        }
+        else if (millis() - ms_offline > OFFLINE_DELAY_MS)
+        {
+            LOGI("lichess unreachable, offline play");
+            pc_fen = NULL;
+            u8_error_count = 0; // lichess is tried again from the offline state
+            ms_offline = millis();
+            e_state = CLIENT_STATE_OFFLINE;
+        }
         else
         {
             delayms(1500UL);
@@ -206,6 +229,8 @@ void loop()
         {
             LOGD("end game stream");
             SHOW_OPPONENT("finish: %s", s_current_game.ac_state);
+            chess::set_hints(true);
+            chess::set_variant(false);
             stream_client.end(true);
             memset(&s_current_game, 0, sizeof(s_current_game));
             CLEAR_BOTTOM_MENU();
@@ -224,7 +249,13 @@ void loop()
         {
             if (chess::get_position(&pc_fen))
             {
-                if (!IS_START_FEN(pc_fen)) {
+                bool b_chess960 = !IS_START_FEN(pc_fen) && chess::is_chess960_start();
+                s_challenge.e_variant = b_chess960 ? VARIANT_CHESS960 : VARIANT_STANDARD;
+                if (b_chess960) {
+                    if (s_challenge.e_player > PLAYER_CUSTOM) {
+                        s_challenge.e_player = PLAYER_CUSTOM; // a seek cannot set the position
+                    }
+                } else if (!IS_START_FEN(pc_fen)) {
                     s_challenge.e_player = PLAYER_AI_LEVEL_HIGH;
                 }
                 SHOW_OPPONENT(get_player_name(&s_challenge));
@@ -312,7 +343,11 @@ void loop()
                 RIGHT_BTN.resetCount();
                 if (s_challenge.e_player < PLAYER_LAST_IDX) {
                     s_challenge.e_player++;
-                    if ((s_challenge.e_player > PLAYER_AI_LEVEL_HIGH) && (!IS_START_FEN(pc_fen))) {
+                    if ((s_challenge.e_player > PLAYER_CUSTOM) && (VARIANT_CHESS960 == s_challenge.e_variant)) {
+                        // chess960 start position on challenges only
+                        s_challenge.e_player = PLAYER_CUSTOM;
+                    } else if ((s_challenge.e_player > PLAYER_AI_LEVEL_HIGH) && (!IS_START_FEN(pc_fen)) &&
+                               (VARIANT_CHESS960 != s_challenge.e_variant)) {
                         // allow custom position on AI opponent only
                         s_challenge.e_player = PLAYER_AI_LEVEL_HIGH;
                     }
@@ -352,6 +387,20 @@ void loop()
         e_state = CLIENT_STATE_CHECK_EVENTS;
         break;
 
+    case CLIENT_STATE_OFFLINE:
+        if (!b_offline_game && (millis() - ms_offline > OFFLINE_DELAY_MS) && wifi::connected())
+        {
+            LOGI("back online");
+            CLEAR_BOTTOM_MENU();
+            pc_fen = NULL;
+            ms_offline = 0;
+            e_state = CLIENT_STATE_INIT;
+            break;
+        }
+        play_offline();
+        (void)chess::wait_position(&u32_position_seq, 50); // or the board changed
+        break;
+
     default:
         e_state = CLIENT_STATE_INIT;
         break;
@@ -593,9 +642,12 @@ static int poll_events()
                     DISPLAY_CLEAR_ROW(45, SCREEN_HEIGHT-45);
                     if ((GAME_STATE_STARTED == result) && s_current_game.ac_id[0])
                     {
+                        chess::set_variant(s_current_game.b_chess960);
                         if (0 == s_current_game.ac_moves[0]) {
                             chess::continue_game(s_current_game.ac_fen);
                         }
+                        set_pgn_tags(&s_current_game);
+                        chess::set_hints(false); // no book help in online games
                         memset(s_current_game.ac_moves, 0, sizeof(s_current_game.ac_moves)); // clear starting moves
                         SHOW_OPPONENT("%.17s %c", s_current_game.ac_opponent, s_current_game.b_color ? 'B' : 'W');
                         SET_BOTTOM_MENU("<-Abort");
@@ -775,4 +827,97 @@ static const char *get_player_name(challenge_st *ps_challenge)
     return name;
 }
 
+static void play_offline()
+{
+    char level[20];
+
+    snprintf(level, sizeof(level), "device level %u", u8_offline_level);
+
+    if (b_offline_game)
+    {
+        uint8_t result = chess::get_result();
+        bool b_resign = (0 != RIGHT_BTN.getCount());
+
+        if (b_resign) {
+            RIGHT_BTN.resetCount();
+        }
+        // the engine stops at the same results, claimable draws play on
+        if (b_resign || (chess::RESULT_NONE != result))
+        {
+            chess::set_opponent(0, chess::BLACK);
+            chess::set_hints(true);
+            b_offline_game = false;
+            CLEAR_BOTTOM_MENU();
+            SHOW_OPPONENT("finish: %s", b_resign ? "resign" : chess::result_to_string(result));
+            // halt task
+            SET_BOTTOM_MENU("            Restart->");
+            e_state = CLIENT_STATE_GAME_FINISHED;
+        }
+    }
+    else if (NULL == pc_fen) // if not yet started
+    {
+        if (chess::get_position(&pc_fen))
+        {
+            SHOW_STATUS("offline");
+            SHOW_OPPONENT(level);
+            SET_BOTTOM_MSG ("Play offline ?");
+            SET_BOTTOM_MENU("<-Black       White->");
+        }
+    }
+    else if (RIGHT_BTN.pressedDuration() >= 1200UL)
+    {
+        RIGHT_BTN.resetCount();
+        if (u8_offline_level < ENGINE_LEVELS) {
+            u8_offline_level++;
+        }
+        snprintf(level, sizeof(level), "device level %u", u8_offline_level);
+        SHOW_OPPONENT(level);
+        b_opponent_changed = true;
+    }
+    else if (LEFT_BTN.pressedDuration() >= 1200UL)
+    {
+        LEFT_BTN.resetCount();
+        if (u8_offline_level > 1) {
+            u8_offline_level--;
+        }
+        snprintf(level, sizeof(level), "device level %u", u8_offline_level);
+        SHOW_OPPONENT(level);
+        b_opponent_changed = true;
+    }
+    else if (b_opponent_changed)
+    {
+        delayms(2000UL);
+        b_opponent_changed = false;
+    }
+    else if (RIGHT_BTN.shortPressed() || LEFT_BTN.shortPressed())
+    {
+        bool b_color = (0 != RIGHT_BTN.getCount()); // player side
+        RIGHT_BTN.resetCount();
+        LEFT_BTN.resetCount();
+
+        chess::set_pgn_tag(chess::PGN_TAG_EVENT, "offline game");
+        chess::set_pgn_tag(chess::PGN_TAG_SITE, "");
+        chess::set_pgn_tag(chess::PGN_TAG_WHITE, b_color ? "player" : level);
+        chess::set_pgn_tag(chess::PGN_TAG_BLACK, b_color ? level : "player");
+        chess::set_hints(false); // no help against the engine either
+        chess::set_opponent(u8_offline_level, b_color ? chess::BLACK : chess::WHITE);
+        b_offline_game = true;
+
+        CLEAR_BOTTOM_MENU();
+        SHOW_OPPONENT("%.17s %c", level, b_color ? 'B' : 'W');
+        SET_BOTTOM_MENU("             Resign->");
+    }
+}
+
+static void set_pgn_tags(const game_st *ps_game)
+{
+    char site[PGN_TAG_LEN];
+
+    snprintf(site, sizeof(site), "https://lichess.org/%s", ps_game->ac_id);
+    chess::set_pgn_tag(chess::PGN_TAG_EVENT, "lichess game");
+    chess::set_pgn_tag(chess::PGN_TAG_SITE, site);
+    chess::set_pgn_tag(chess::PGN_TAG_WHITE, ps_game->b_color ? ac_username : ps_game->ac_opponent);
+    chess::set_pgn_tag(chess::PGN_TAG_BLACK, ps_game->b_color ? ps_game->ac_opponent : ac_username);
+}
+
 } // namespace lichess
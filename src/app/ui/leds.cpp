@@ -20,6 +20,16 @@ static rmt_transmit_config_t led_tx_cfg;
 static uint8_t              led_strip_pixels[LED_STRIP_NUMPIXELS * 3 /*rgb bytes*/];
 static SemaphoreHandle_t    mtx = NULL;
 
+static const uint8_t K_RGB[][6] = {
+    // light squares  , dark squares
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // off
+    { 0x06, 0x00, 0x00, 0x10, 0x00, 0x00 }, // red_low
+    { 0x50, 0x00, 0x00, 0xff, 0x00, 0x00 }, // red
+    { 0x30, 0x0f, 0x00, 0x50, 0xdf, 0x00 }, // orange
+    { 0x10, 0x0f, 0x00, 0x20, 0xff, 0x00 }, // yellow
+    { 0x04, 0x0f, 0x00, 0x00, 0xff, 0x00 }, // green
+};
+
 
 bool init(void)
 {
@@ -90,17 +100,23 @@ static void led_strip_set_pixel(uint16_t index, uint8_t red, uint8_t green, uint
 }
 
 
-void setColor(uint8_t u8_rank, uint8_t u8_file, uint8_t u8_red, uint8_t u8_green, uint8_t u8_blue)
+/* two pixels per square, caller holds the mutex */
+static void led_strip_set_square(uint8_t u8_rank, uint8_t u8_file, uint8_t u8_red, uint8_t u8_green, uint8_t u8_blue)
 {
     uint16_t u16_mid     = (uint16_t)(u8_file >> 2) << 6;
     uint16_t u16_offset  = u16_mid + ((u8_rank) << 3);
 
     u8_file &= 0x03; // %4
 
+    led_strip_set_pixel(u16_offset + u8_file,     u8_red, u8_green, u8_blue);
+    led_strip_set_pixel(u16_offset + 7 - u8_file, u8_red, u8_green, u8_blue);
+}
+
+void setColor(uint8_t u8_rank, uint8_t u8_file, uint8_t u8_red, uint8_t u8_green, uint8_t u8_blue)
+{
     if (init_done && (pdTRUE == xSemaphoreTake(mtx, portMAX_DELAY)))
     {
-        led_strip_set_pixel(u16_offset + u8_file,     u8_red, u8_green, u8_blue);
-        led_strip_set_pixel(u16_offset + 7 - u8_file, u8_red, u8_green, u8_blue);
+        led_strip_set_square(u8_rank, u8_file, u8_red, u8_green, u8_blue);
         xSemaphoreGive(mtx);
     }
 }
@@ -124,17 +140,6 @@ void setColor(uint8_t u8_rank, uint8_t u8_file, led_color_et e_color)
         setColor(u8_rank, u8_file, au8_test_rgb[3], au8_test_rgb[4], au8_test_rgb[5]);
     }
 #else
-
-    static const uint8_t K_RGB[][6] = {
-        // light squares  , dark squares
-        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // off
-        { 0x06, 0x00, 0x00, 0x10, 0x00, 0x00 }, // red_low
-        { 0x50, 0x00, 0x00, 0xff, 0x00, 0x00 }, // red
-        { 0x30, 0x0f, 0x00, 0x50, 0xdf, 0x00 }, // orange
-        { 0x10, 0x0f, 0x00, 0x20, 0xff, 0x00 }, // yellow
-        { 0x04, 0x0f, 0x00, 0x00, 0xff, 0x00 }, // green
-    };
-
     uint8_t u8_idx = 0;
     uint8_t u8_offset = 0;
 
@@ -161,6 +166,26 @@ void setColor(uint8_t /*square_et*/ e_square, led_color_et e_color)
     setColor(u8_rank, u8_file, e_color);
 }
 
+void setColors(uint64_t u64_squares, led_color_et e_color)
+{
+    uint8_t u8_idx = ((e_color >= LED_RED_LOW) && (e_color <= LED_GREEN)) ? e_color : 0;
+
+    if (init_done && (0 != u64_squares) && (pdTRUE == xSemaphoreTake(mtx, portMAX_DELAY)))
+    {
+        while (0 != u64_squares)
+        {
+            uint8_t u8_bit    = __builtin_ctzll(u64_squares);
+            uint8_t u8_rank   = u8_bit >> 3;
+            uint8_t u8_file   = u8_bit & 7;
+            uint8_t u8_offset = LIGHT_SQUARE(u8_rank, u8_file) ? 0 : 3; // dark square
+
+            led_strip_set_square(u8_rank, u8_file, K_RGB[u8_idx][u8_offset], K_RGB[u8_idx][u8_offset+1], K_RGB[u8_idx][u8_offset+2]);
+            u64_squares &= u64_squares - 1; // next
+        }
+        xSemaphoreGive(mtx);
+    }
+}
+
 #ifdef LED_TESTS
 
 void test(void)
@@ -28,6 +28,7 @@ void clear(void);
 void setColor(uint8_t u8_rank, uint8_t u8_file, uint8_t u8_red, uint8_t u8_green, uint8_t u8_blue);
 void setColor(uint8_t u8_rank, uint8_t u8_file, led_color_et e_color);
 void setColor(uint8_t /*square_et*/ e_square, led_color_et e_color);
+void setColors(uint64_t u64_squares /*bit = rank * 8 + file*/, led_color_et e_color); // one lock for all
 
 //#define LED_TESTS
 
@@ -197,13 +197,29 @@ esp_err_t get_fen_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-/* send current PGN */
+/* send current PGN, "?ply=N" for the moves after ply N only, "?tags" for a full export */
 esp_err_t get_pgn_handler(httpd_req_t *req)
 {
-    const char *pgn = NULL;
-    chess::get_pgn(&pgn);
+    const char *ply = strstr(req->uri, "ply=");
+    char buf[256];
+    uint16_t len;
+
+    chess::pgn_reader_st *reader = chess::open_pgn(ply ? atoi(ply + strlen("ply=")) : 0, NULL != strstr(req->uri, "tags"));
     httpd_resp_set_type(req, "text/plain");
-    httpd_resp_sendstr(req, pgn ? pgn : "...");
+    if (NULL == reader)
+    {
+        httpd_resp_sendstr(req, "...");
+        return ESP_OK;
+    }
+
+    // chunked, no length cap
+    while (0 != (len = chess::read_pgn(reader, buf, sizeof(buf))))
+    {
+        if (ESP_OK != httpd_resp_send_chunk(req, buf, len))
+            break;
+    }
+    chess::close_pgn(reader);
+    httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
 
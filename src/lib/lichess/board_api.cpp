@@ -89,6 +89,7 @@ int parse_game_event(const cJSON *event, game_st *ps_game /*output*/)
                 const char *fen         = GET_STR(obj, "fen");
                 const char *lastmove    = GET_STR(obj, "lastMove");
                 const char *status_name = GET_STR(status, "name");
+                const char *variant     = GET_STR2(obj, "variant", "key");
 
                 strncpy(ps_game->ac_id, id, sizeof(ps_game->ac_id) - 1);
                 strncpy(ps_game->ac_fen, fen, sizeof(ps_game->ac_fen) - 1);
@@ -98,6 +99,7 @@ int parse_game_event(const cJSON *event, game_st *ps_game /*output*/)
 
                 ps_game->b_color        = color[0] == 'w';
                 ps_game->b_turn         = cJSON_IsTrue(cJSON_GetObjectItem(obj, "isMyTurn"));
+                ps_game->b_chess960     = (NULL != variant) && SAME_STR(variant, "chess960");
                 ps_game->e_state        = (game_state_et) cJSON_GetNumberValue(cJSON_GetObjectItem(status, "id"));
 
                 return ps_game->e_state;
@@ -45,6 +45,7 @@ typedef struct {
     uint32_t        u32_binc;
     bool            b_color;        // us; true = white
     bool            b_turn;         // isMyTurn
+    bool            b_chess960;     // variant
 } game_st;
 
 
@@ -37,12 +37,17 @@ static inline game_variant_et get_variant(const char *variant)
     if (SAME_STR(variant, "standard")) {
         e_variant = VARIANT_STANDARD;
     } else if (SAME_STR(variant, "chess960")) {
-        //e_variant = VARIANT_CHESS960; to do
+        e_variant = VARIANT_CHESS960;
     }
 
     return e_variant;
 }
 
+static inline const char *get_variant_key(game_variant_et e_variant)
+{
+    return (VARIANT_CHESS960 == e_variant) ? "chess960" : "standard";
+}
+
 static inline game_speed_et get_speed(const char *speed)
 {
     game_speed_et e_speed = SPEED_UNKNOWN;
@@ -134,10 +139,11 @@ bool ApiClient::decline_challenge(const char *challenge_id, const char *reason)
 
 bool ApiClient::create_seek(const challenge_st *ps_challenge)
 {
-    int len = SET_PAYLOAD("rated=%s&time=%u&increment=%u&variant=standard&color=%s",
+    int len = SET_PAYLOAD("rated=%s&time=%u&increment=%u&variant=%s&color=%s",
                         ps_challenge->b_rated ? "true" : "false",
                         ps_challenge->u16_clock_limit / 60, // in minutes
                         ps_challenge->u8_clock_increment,   // in seconds
+                        get_variant_key(ps_challenge->e_variant),
                         ps_challenge->b_color ? "white" : "black");
 
     LOGD("play as %s vs %s:\r\n%s", ps_challenge->b_color ? "white" : "black", ps_challenge->ac_user, _rsp_buf);
@@ -159,8 +165,11 @@ bool ApiClient::create_challenge(const challenge_st *ps_challenge, const char *f
     }
     else if ((PLAYER_BOT_MAIA9 == ps_challenge->e_player) || (PLAYER_CUSTOM == ps_challenge->e_player))
     {
-        payload_len = SET_PAYLOAD("rated=%s&keepAliveStream=%s&rules=%s",
-                        ps_challenge->b_rated ? "true" : "false", "false", "noRematch,noClaimWin,noEarlyDraw");
+        // chess960 from the board's start position, which cannot be rated
+        bool b_fen = (VARIANT_CHESS960 == ps_challenge->e_variant);
+        payload_len = SET_PAYLOAD("rated=%s&keepAliveStream=%s&rules=%s%s%s",
+                        (ps_challenge->b_rated && !b_fen) ? "true" : "false", "false", "noRematch,noClaimWin,noEarlyDraw",
+                        b_fen ? "&fen=" : "", b_fen ? fen : "");
     }
     else
     {
@@ -172,7 +181,7 @@ bool ApiClient::create_challenge(const challenge_st *ps_challenge, const char *f
                             ps_challenge->u16_clock_limit,
                             ps_challenge->u8_clock_increment,
                             ps_challenge->b_color ? "white" : "black",
-                            "standard");
+                            get_variant_key(ps_challenge->e_variant));
 
     LOGD("play as %s vs %s:\r\n%s", ps_challenge->b_color ? "white" : "black", ps_challenge->ac_user, _rsp_buf);
     return api_post(_uri, (const uint8_t *)_rsp_buf, payload_len);
@@ -7,11 +7,11 @@ namespace lichess
 typedef enum {
     VARIANT_UNKNOWN,
     VARIANT_STANDARD,
-    //VARIANT_CHESS960, // to do
+    VARIANT_CHESS960,
     //VARIANT_CRAZYHOUSE,
     //VARIANT_ANTICHESS,
     //VARIANT_ATOMIC,
-} game_variant_et;  // limit to standard only
+} game_variant_et;  // limit to standard and chess960
 
 typedef enum {
     SPEED_UNKNOWN,
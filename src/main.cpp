@@ -2,6 +2,7 @@
 #include "globals.h"
 
 #include "board/board.h"
+#include "chess/chess.h"
 #include "lichess/lichess_client.h"
 #include "ui/ui.h"
 #include "wifi/wifi_setup.h"
@@ -18,6 +19,7 @@
 
 DECLARE_TASK(Board,     brd::init,      brd::loop,      2);
 DECLARE_TASK(Client,    lichess::init,  lichess::loop, 10);
+DECLARE_TASK(Engine,    chess::engine_init, chess::engine_loop, 20);
 DECLARE_TASK(Ui,        ui::init,       ui::loop,       5);
 DECLARE_TASK(Wifi,      wifi::init,     wifi::loop,    10);
 
@@ -39,4 +41,5 @@ extern "C" void app_main(void)
     RUN_TASK(Board,     4*1024, 5);
     RUN_TASK(Wifi,      8*1024, 4);
     RUN_TASK(Client,    8*1024, 7);
+    RUN_TASK(Engine,    8*1024, 1); // below everything else, searches in the idle time
 }
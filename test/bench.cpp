@@ -0,0 +1,393 @@
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chess/chess.h"
+#include "chess/chess_priv.h"
+#include "utlist/utlist.h"
+
+using namespace chess;
+
+/* host benchmarks of the chess core, "bench -q" runs a tenth of the iterations (ctest),
+   bench_0x88 is built without the bitboards */
+
+typedef struct {
+    const char *name;
+    const char *fen;
+} bench_position_st;
+
+static const bench_position_st BENCH_POSITIONS[] = {
+    { "start",      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" },
+    { "kiwipete",   "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1" },
+    { "middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10" },
+    { "endgame",    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1" },
+};
+
+static uint32_t     u32_iterations = 100000;
+static volatile uint32_t u32_sink;  // keeps the measured work
+static uint32_t     u32_allocs;     // malloc calls, see __wrap_malloc()
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__wrap_malloc(size_t size)
+{
+    u32_allocs++;
+    return __real_malloc(size);
+}
+
+static inline double now_ns(void)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* crowded positions, by move count */
+static const bench_position_st CROWDED_POSITIONS[] = {
+    { "closed",     "r1bq1rk1/pp2bppp/2n1pn2/2pp4/2PP4/2NBPN2/PP3PPP/R1BQ1RK1 w - - 0 8" },
+    { "sicilian",   "r1b2rk1/2q1bppp/p1nppn2/1p6/3NPP2/1BN1B3/PPP1Q1PP/2KR3R w - - 0 12" },
+    { "kiwipete",   "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1" },
+    { "queens",     "7k/6pp/8/8/2QQQ3/2QQQ3/8/K7 w - - 0 1" },
+    { "max moves",  "R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1" },
+};
+
+/* user-001: malloc'ed utlist nodes of the former generate_moves(), against the fixed-capacity list,
+   user-002: with its LL_SEARCH for duplicates if b_search */
+typedef struct legacy_move_s {
+    move_st               move;
+    struct legacy_move_s *next;
+} legacy_move_st;
+
+static inline int legacy_compare(const legacy_move_st *a, const legacy_move_st *b)
+{
+    return ((a->move.from == b->move.from) && (a->move.to == b->move.to)) ? 0 : 1;
+}
+
+static uint32_t legacy_generate(game_st *p_game, move_list_st *list, bool b_search)
+{
+    legacy_move_st *head = NULL;
+    legacy_move_st *elt;
+    legacy_move_st *tmp;
+    uint32_t        count = 0;
+
+    generate_moves(p_game, list);
+    for (uint8_t i = 0; i < list->count; i++) {
+        if (b_search) {
+            legacy_move_st like;
+            like.move = list->moves[i];
+            LL_SEARCH(head, elt, &like, legacy_compare);
+            if (NULL != elt)
+                continue;
+        }
+        if (NULL != (elt = (legacy_move_st *)malloc(sizeof(legacy_move_st)))) {
+            elt->move = list->moves[i];
+            LL_APPEND(head, elt);
+        }
+    }
+    LL_FOREACH_SAFE(head, elt, tmp) {
+        LL_DELETE(head, elt);
+        free(elt);
+        count++;
+    }
+
+    return count;
+}
+
+static void bench_move_list(void)
+{
+    static game_st      s_game;
+    static move_list_st s_list;
+
+    printf("\ngenerate_moves    moves  allocs/call  ns/call  legacy allocs/call  ns/call\n");
+    for (const bench_position_st &pos : BENCH_POSITIONS)
+    {
+        load_fen(&s_game, pos.fen);
+
+        u32_allocs = 0;
+        double t_start = now_ns();
+        for (uint32_t i = 0; i < u32_iterations; i++) {
+            u32_sink = generate_moves(&s_game, &s_list);
+        }
+        double   ns_list = (now_ns() - t_start) / u32_iterations;
+        uint32_t allocs_list = u32_allocs;
+
+        u32_allocs = 0;
+        t_start = now_ns();
+        for (uint32_t i = 0; i < u32_iterations; i++) {
+            u32_sink = legacy_generate(&s_game, &s_list, false);
+        }
+        double   ns_legacy = (now_ns() - t_start) / u32_iterations;
+
+        printf("  %-14s  %5u  %11.1f  %7.0f  %18.1f  %7.0f\n", pos.name, s_list.count,
+            (double)allocs_list / u32_iterations, ns_list, (double)u32_allocs / u32_iterations, ns_legacy);
+    }
+}
+
+static void bench_duplicates(void)
+{
+    static game_st      s_game;
+    static move_list_st s_list;
+
+    printf("\ngenerate_moves    moves  ns/call  ns/move  LL_SEARCH ns/call  ns/move\n");
+    for (const bench_position_st &pos : CROWDED_POSITIONS)
+    {
+        load_fen(&s_game, pos.fen);
+
+        double t_start = now_ns();
+        for (uint32_t i = 0; i < u32_iterations; i++) {
+            u32_sink = generate_moves(&s_game, &s_list);
+        }
+        double ns_list = (now_ns() - t_start) / u32_iterations;
+
+        t_start = now_ns();
+        for (uint32_t i = 0; i < u32_iterations; i++) {
+            u32_sink = legacy_generate(&s_game, &s_list, true);
+        }
+        double ns_legacy = (now_ns() - t_start) / u32_iterations;
+
+        printf("  %-14s  %5u  %7.0f  %7.1f  %17.0f  %7.1f\n", pos.name, s_list.count,
+            ns_list, ns_list / s_list.count, ns_legacy, ns_legacy / s_list.count);
+    }
+}
+
+/* user-004: the former attacked(), over every square of the 0x88 board */
+static bool scan_attacked(const game_st *p_game, uint8_t color, uint8_t square)
+{
+    const uint8_t *board = p_game->board;
+
+    for (uint8_t i = a8; i <= h1; i++)
+    {
+        uint8_t piece = board[i];
+        if ((FILE(i) > 7) || (0 == piece) || (PIECE_COLOR(piece) != color))
+            continue;
+
+        int16_t difference = i - square;
+        int16_t index = difference + h1;
+        uint8_t type  = PIECE_TYPE(piece);
+
+        if ((index < 0) || (index >= (int16_t)sizeof(ATTACKS)) || !(ATTACKS[index] & (1 << SHIFTS[PIECE_INT(type)])))
+            continue;
+
+        if (PAWN == type) {
+            if ((difference > 0) == (WHITE == color)) return true;
+        } else if ((KNIGHT == type) || (KING == type)) {
+            return true;
+        } else {
+            int16_t j = i + RAYS[index];
+            while ((j != square) && (0 == board[j])) {
+                j += RAYS[index];
+            }
+            if (j == square) return true;
+        }
+    }
+
+    return false;
+}
+
+static void bench_attacked(void)
+{
+    static game_st s_game;
+    uint32_t rounds = u32_iterations / 100;
+
+    printf("\nattacked()     calls/leaf  ns/call  128-square scan ns/call  mismatches\n");
+    for (const bench_position_st &pos : BENCH_POSITIONS)
+    {
+        load_fen(&s_game, pos.fen);
+
+        bench_counters.attacked = 0;
+        uint32_t leaves = perft(&s_game, 3);
+        double   calls = (double)bench_counters.attacked / leaves;
+
+        double t_start = now_ns();
+        for (uint32_t i = 0; i < rounds; i++) {
+            for (uint8_t idx = 0; idx < 64; idx++) {
+                u32_sink = attacked(&s_game, WHITE, IDX_TO_SQUARE(idx)) + attacked(&s_game, BLACK, IDX_TO_SQUARE(idx));
+            }
+        }
+        double ns_attacked = (now_ns() - t_start) / (rounds * 128);
+
+        t_start = now_ns();
+        for (uint32_t i = 0; i < rounds; i++) {
+            for (uint8_t idx = 0; idx < 64; idx++) {
+                u32_sink = scan_attacked(&s_game, WHITE, IDX_TO_SQUARE(idx)) + scan_attacked(&s_game, BLACK, IDX_TO_SQUARE(idx));
+            }
+        }
+        double ns_scan = (now_ns() - t_start) / (rounds * 128);
+
+        uint32_t mismatches = 0;
+        for (uint8_t idx = 0; idx < 128; idx++) {
+            uint8_t color = idx >> 6;
+            mismatches += attacked(&s_game, color, IDX_TO_SQUARE(idx & 63)) != scan_attacked(&s_game, color, IDX_TO_SQUARE(idx & 63));
+        }
+
+        printf("  %-11s  %10.2f  %7.1f  %23.1f  %10u\n", pos.name, calls, ns_attacked, ns_scan, mismatches);
+    }
+}
+
+/* user-008: the former piece macros, against the constexpr tables */
+#define LEGACY_PIECE_TYPE(u8_piece)     (tolower(u8_piece))
+#define LEGACY_PIECE_COLOR(u8_piece)    (isupper(u8_piece) ? WHITE : BLACK)
+#define LEGACY_PIECE_INT(u7_type)       (PAWN==(u7_type) ? 1 : (KNIGHT==(u7_type) ? 2 : (BISHOP==(u7_type) ? 3 : (ROOK==(u7_type) ? 4 : \
+                                        (QUEEN==(u7_type) ? 5 : (KING==(u7_type) ? 6 : 0))))))
+
+static void bench_piece_tables(void)
+{
+    static game_st s_game;
+    uint32_t rounds = u32_iterations / 10;
+    uint32_t sum = 0;
+
+    load_fen(&s_game, BENCH_POSITIONS[2].fen);
+
+    double t_start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        for (uint8_t sq = a8; sq <= h1; sq++) {
+            uint8_t piece = s_game.board[sq];
+            sum += PIECE_INT(PIECE_TYPE(piece)) + PIECE_COLOR(piece);
+        }
+        u32_sink = sum;
+    }
+    double ns_tables = (now_ns() - t_start) / (rounds * 128);
+
+    t_start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        for (uint8_t sq = a8; sq <= h1; sq++) {
+            uint8_t piece = s_game.board[sq];
+            sum += LEGACY_PIECE_INT(LEGACY_PIECE_TYPE(piece)) + LEGACY_PIECE_COLOR(piece);
+        }
+        u32_sink = sum;
+    }
+    double ns_legacy = (now_ns() - t_start) / (rounds * 128);
+
+    printf("\npiece type, color and index, ns/square: tables %.2f, tolower/isupper/ternaries %.2f\n", ns_tables, ns_legacy);
+}
+
+/* user-007: board diffing, and perft throughput to compare with bench_0x88 */
+static uint64_t loop_changed(const game_st *p_game, const uint8_t *scan)
+{
+    uint64_t changed = 0;
+
+    for (uint8_t idx = 0; idx < 64; idx++) {
+        if (scan[idx] != p_game->board[IDX_TO_SQUARE(idx)]) {
+            changed |= 1ULL << idx;
+        }
+    }
+
+    return changed;
+}
+
+static void bench_diff(void)
+{
+    static game_st      s_game;
+    static move_list_st s_list;
+    uint8_t  scan[64];
+    uint8_t  u8_from;
+    uint64_t u64_targets;
+    move_st  move;
+
+    load_fen(&s_game, BENCH_POSITIONS[2].fen);
+    generate_moves(&s_game, &s_list);
+    for (uint8_t idx = 0; idx < 64; idx++) {
+        scan[idx] = s_game.board[IDX_TO_SQUARE(idx)];
+    }
+
+    double t_start = now_ns();
+    for (uint32_t i = 0; i < u32_iterations; i++) {
+        u32_sink = find_move(&s_game, &s_list, scan, &move);
+    }
+    double ns_same = (now_ns() - t_start) / u32_iterations;
+
+    t_start = now_ns();
+    for (uint32_t i = 0; i < u32_iterations; i++) {
+        u32_sink = (uint32_t)loop_changed(&s_game, scan);
+    }
+    double ns_loop = (now_ns() - t_start) / u32_iterations;
+
+    scan[SQUARE_TO_IDX(f3)] = 0; // lifted knight
+    t_start = now_ns();
+    for (uint32_t i = 0; i < u32_iterations; i++) {
+        u32_sink = hint_moves(&s_game, &s_list, scan, &u8_from, &u64_targets);
+    }
+    double ns_lifted = (now_ns() - t_start) / u32_iterations;
+
+    scan[SQUARE_TO_IDX(h4)] = 'N';
+    t_start = now_ns();
+    for (uint32_t i = 0; i < u32_iterations; i++) {
+        u32_sink = find_move(&s_game, &s_list, scan, &move);
+    }
+    double ns_move = (now_ns() - t_start) / u32_iterations;
+
+    printf("\nboard diff, ns/call: unchanged find_move %.0f (square loop alone %.0f), lifted hint_moves %.0f, Nf3-h4 find_move %.0f\n",
+        ns_same, ns_loop, ns_lifted, ns_move);
+}
+
+static void bench_fen(void)
+{
+    static game_st s_game;
+    uint32_t rounds = u32_iterations / 10;
+
+    printf("\nload_fen        ns/call\n");
+    for (const bench_position_st &pos : BENCH_POSITIONS)
+    {
+        double t_start = now_ns();
+        for (uint32_t i = 0; i < rounds; i++) {
+            u32_sink = load_fen(&s_game, pos.fen);
+        }
+        printf("  %-11s  %8.0f\n", pos.name, (now_ns() - t_start) / rounds);
+    }
+}
+
+static void bench_perft(void)
+{
+    static game_st s_game;
+
+    printf("\nperft          depth       leaves    Mnps\n");
+    for (const bench_position_st &pos : BENCH_POSITIONS)
+    {
+        uint8_t depth = (u32_iterations < 100000) ? 3 : 5;
+
+        load_fen(&s_game, pos.fen);
+        double   t_start = now_ns();
+        uint32_t leaves = perft(&s_game, depth);
+        double   ns = now_ns() - t_start;
+
+        printf("  %-11s  %5u  %11u  %6.1f\n", pos.name, depth, leaves, leaves / ns * 1e3);
+    }
+}
+
+static void bench_search(void)
+{
+    static game_st s_game;
+    search_result_st result;
+
+    if (!search_init(15))
+        return;
+
+    printf("\nsearch         depth        nodes      ms    knps\n");
+    for (const bench_position_st &pos : BENCH_POSITIONS)
+    {
+        uint8_t depth = (u32_iterations < 100000) ? 4 : 6;
+
+        load_fen(&s_game, pos.fen);
+        search(&s_game, 60000, depth, &result);
+
+        printf("  %-11s  %5u  %11u  %6u  %6.1f\n", pos.name, result.depth, result.nodes, result.ms,
+            (double)result.nodes / (result.ms ? result.ms : 1));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if ((argc > 1) && (0 == strcmp(argv[1], "-q"))) {
+        u32_iterations /= 10;
+    }
+
+    bench_move_list();
+    bench_duplicates();
+    bench_attacked();
+    bench_piece_tables();
+    bench_diff();
+    bench_fen();
+    bench_perft();
+    bench_search();
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chess/chess.h"
+
+/* host tests: failures are counted and printed, the exit code is the verdict */
+static uint32_t u32_failures = 0;
+
+#define CHECK(cond, fmt, ...)           do { if (!(cond)) { u32_failures++;                                 \
+                                            printf("FAIL %s:%d " fmt "\n", __FILE__, __LINE__, ## __VA_ARGS__); } \
+                                        } while (0)
+#define TEST_EXIT()                     (printf("%s\n", (0 == u32_failures) ? "OK" : "FAILED"), (0 == u32_failures) ? 0 : 1)
@@ -0,0 +1,173 @@
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#include "test.h"
+#include "polyglot_keys.h"
+
+using namespace chess;
+
+static char s_book_file[32]; // per process, the variants may run in parallel
+
+static const char *STANDARD_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"; // START_FEN is in chess.cpp
+
+/* published polyglot keys (book format spec), en passant keyed only when the capture is possible */
+static const struct {
+    const char *moves;
+    uint64_t    key;
+} KEYS[] = {
+    { "",                                   0x463B96181691FC9CULL },
+    { "e2e4",                               0x823C9B50FD114196ULL },
+    { "e2e4 d7d5",                          0x0756B94461C50FB0ULL },
+    { "e2e4 d7d5 e4e5",                     0x662FAFB965DB29D4ULL },
+    { "e2e4 d7d5 e4e5 f7f5",                0x22A48B5A8E47FF78ULL },
+    { "e2e4 d7d5 e4e5 f7f5 e1e2",           0x652A607CA3F242C1ULL },
+    { "e2e4 d7d5 e4e5 f7f5 e1e2 e8f7",      0x00FDD303C946BDD9ULL },
+    { "a2a4 b7b5 h2h4 b5b4 c2c4",           0x3C8123EA7B067637ULL },
+    { "a2a4 b7b5 h2h4 b5b4 c2c4 b4c3 a1a3", 0x5C3F9B829B279560ULL },
+};
+
+typedef struct {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+} entry_st;
+
+/* plays the space separated UCI moves */
+static bool play(game_st *p_game, const char *fen, const char *moves)
+{
+    move_list_st list;
+    move_st      move;
+    char         uci[8];
+
+    load_fen(p_game, fen);
+    while (1 == sscanf(moves, "%7s", uci))
+    {
+        generate_moves(p_game, &list);
+        if (!parse_move(&list, uci, &move))
+            return false;
+        make_move(p_game, &move);
+        moves = strchr(moves, ' ');
+        if (NULL == moves)
+            break;
+        moves++;
+    }
+
+    return true;
+}
+
+/* polyglot move bits: to file, to row, from file, from row, promotion */
+static entry_st entry(const game_st *p_game, const char *uci, uint16_t weight, uint8_t promo = 0)
+{
+    uint16_t move = (uci[2] - 'a') | ((uci[3] - '1') << 3) | ((uci[0] - 'a') << 6) | ((uci[1] - '1') << 9) | (promo << 12);
+    return { position_key(p_game, POLYGLOT_RANDOM64), move, weight };
+}
+
+static void put_be(FILE *file, uint64_t value, uint8_t size)
+{
+    while (size--) {
+        fputc((uint8_t)(value >> (size * 8)), file);
+    }
+}
+
+static bool write_book(std::vector<entry_st> entries)
+{
+    snprintf(s_book_file, sizeof(s_book_file), "test_book_%d.bin", (int)getpid());
+    FILE *file = fopen(s_book_file, "wb");
+    if (NULL == file)
+        return false;
+
+    std::stable_sort(entries.begin(), entries.end(), [](const entry_st &a, const entry_st &b) { return a.key < b.key; });
+    put_be(file, 0x50474B31, 4); // "PGK1"
+    put_be(file, entries.size(), 4);
+    for (uint64_t key : POLYGLOT_RANDOM64) {
+        put_be(file, key, 8);
+    }
+    for (const entry_st &elt : entries) {
+        put_be(file, elt.key, 8);
+        put_be(file, elt.move, 2);
+        put_be(file, elt.weight, 2);
+        put_be(file, 0, 4);
+    }
+
+    return 0 == fclose(file);
+}
+
+static uint8_t lookup(game_st *p_game, move_st *moves, uint16_t *weights)
+{
+    move_list_st list;
+
+    generate_moves(p_game, &list);
+    return book_moves(p_game, &list, moves, weights, 8);
+}
+
+int main(void)
+{
+    static game_st s_game;
+    std::vector<entry_st> entries;
+    move_st  moves[8];
+    uint16_t weights[8];
+
+    /* start: by weight, zero weight and illegal entries skipped */
+    load_fen(&s_game, STANDARD_FEN);
+    entries.push_back(entry(&s_game, "e2e4", 10));
+    entries.push_back(entry(&s_game, "d2d4", 20));
+    entries.push_back(entry(&s_game, "c2c4", 0));
+    entries.push_back(entry(&s_game, "a1a5", 30));
+    entries.push_back(entry(&s_game, "g1f3", 5));
+
+    /* castling is king takes own rook */
+    load_fen(&s_game, "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+    entries.push_back(entry(&s_game, "e1a1", 3));
+    entries.push_back(entry(&s_game, "e1h1", 7));
+    entries.push_back(entry(&s_game, "e1f1", 1));
+
+    /* promotions: knight 1 .. queen 4 */
+    load_fen(&s_game, "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1");
+    entries.push_back(entry(&s_game, "g2f1", 9, 4));
+    entries.push_back(entry(&s_game, "g2g1", 4, 1));
+
+    /* unrelated keys, the lookup spans several cached pages */
+    srand(15);
+    for (uint32_t n = 0; n < 500; n++) {
+        entries.push_back({ ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand(), 0x0123, 1 });
+    }
+
+    CHECK(0 == book_key(&s_game), "key without a book");
+    CHECK(write_book(entries) && book_open(s_book_file), "book %s", s_book_file);
+
+    for (const auto &elt : KEYS) {
+        CHECK(play(&s_game, STANDARD_FEN, elt.moves), "play %s", elt.moves);
+        CHECK(elt.key == book_key(&s_game), "%s: key %016llx, expected %016llx", elt.moves,
+            (unsigned long long)book_key(&s_game), (unsigned long long)elt.key);
+    }
+
+    load_fen(&s_game, STANDARD_FEN);
+    CHECK(3 == lookup(&s_game, moves, weights), "start, %u moves", lookup(&s_game, moves, weights));
+    CHECK((d2 == moves[0].from) && (d4 == moves[0].to) && (20 == weights[0]), "start, first d2d4");
+    CHECK((e2 == moves[1].from) && (e4 == moves[1].to) && (10 == weights[1]), "start, second e2e4");
+    CHECK((g1 == moves[2].from) && (f3 == moves[2].to) && (5 == weights[2]), "start, third g1f3");
+
+    load_fen(&s_game, "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+    CHECK(3 == lookup(&s_game, moves, weights), "castling, %u moves", lookup(&s_game, moves, weights));
+    CHECK(moves[0].flags & BIT_KSIDE_CASTLE, "castling, first O-O");
+    CHECK(moves[1].flags & BIT_QSIDE_CASTLE, "castling, second O-O-O");
+    CHECK((f1 == moves[2].to) && !(moves[2].flags & BITS_CASTLE), "castling, third Kf1");
+
+    load_fen(&s_game, "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1");
+    CHECK(2 == lookup(&s_game, moves, weights), "promotions, %u moves", lookup(&s_game, moves, weights));
+    CHECK((f1 == moves[0].to) && (QUEEN == moves[0].promoted), "promotions, first gxf1=Q");
+    CHECK((g1 == moves[1].to) && (KNIGHT == moves[1].promoted), "promotions, second g1=N");
+
+    move_list_st list;
+    load_fen(&s_game, STANDARD_FEN);
+    generate_moves(&s_game, &list);
+    CHECK((1 == book_moves(&s_game, &list, moves, weights, 1)) && (d4 == moves[0].to), "start, heaviest only");
+    play(&s_game, STANDARD_FEN, "h2h3");
+    CHECK(0 == lookup(&s_game, moves, weights), "out of book");
+
+    book_close();
+    remove(s_book_file);
+
+    return TEST_EXIT();
+}
@@ -0,0 +1,264 @@
+#include <ctype.h>
+
+#include "test.h"
+
+using namespace chess;
+
+/* fields of the position, counters always written (generate_fen is in chess.cpp) */
+static void format_fen(const game_st *p_game, char *fen)
+{
+    for (uint8_t rank = RANK_8; rank <= RANK_1; rank++)
+    {
+        uint8_t empty = 0;
+
+        for (uint8_t sq = rank << 4; FILE(sq) < 8; sq++) {
+            if (0 == p_game->board[sq]) {
+                empty++;
+                continue;
+            }
+            if (empty) {
+                *fen++ = '0' + empty;
+                empty = 0;
+            }
+            *fen++ = p_game->board[sq];
+        }
+        if (empty) {
+            *fen++ = '0' + empty;
+        }
+        if (RANK_1 != rank) {
+            *fen++ = '/';
+        }
+    }
+
+    *fen++ = ' ';
+    *fen++ = (WHITE == p_game->stats.turn) ? 'w' : 'b';
+    *fen++ = ' ';
+    fen += format_castling(p_game, fen);
+    *fen++ = ' ';
+    if (p_game->stats.ep_square) {
+        *fen++ = FILE(p_game->stats.ep_square) + 'a';
+        *fen++ = '0' + (8 - RANK(p_game->stats.ep_square));
+    } else {
+        *fen++ = '-';
+    }
+    sprintf(fen, " %u %u", p_game->stats.half_moves, p_game->stats.move_number);
+}
+
+/* accepted as written, round trip through format_fen() */
+static const char *VALID_FENS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w KQkq - 2 9",
+    "4k3/8/8/8/8/8/8/RR2K3 w B - 0 1",                           // X-FEN, inner rook
+    "4k3/8/8/8/8/8/8/4K3 b - - 99 9999",
+};
+
+/* normalised on the way back */
+static const struct {
+    const char *fen;
+    const char *normal;
+} NORMAL_FENS[] = {
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -",     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w HAha - 0 1", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w qkQK - 0 1", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" },
+    { "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9", "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w KQkq - 2 9" },
+    { "1r2k1r1/8/8/8/8/8/8/R3K1R1 w GAgb - 0 1",                  "1r2k1r1/8/8/8/8/8/8/R3K1R1 w KQkq - 0 1" },
+};
+
+static const char *REJECTED_FENS[] = {
+    /* field counts */
+    "",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 0",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR  w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq  - 0 1",
+    /* placement */
+    "rnbqkbnrr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",  // overlong rank
+    "rnbqkbnr/ppppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/44/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",  // digits in a row
+    "rnbqkbnr/pppppppp/7p1/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/7/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",   // short rank
+    "rnbqkbnr/pppppppp/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",     // seven ranks
+    "rnbqkbnr/pppppppp/8/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", // nine ranks
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR/ w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNX w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQ1BNR w kq - 0 1",     // no white king
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBKKBNR w kq - 0 1",     // two white kings
+    "rnbqkbnr/pppppppp/8/8/8/P7/PPPPPPPP/RNBQKBNR w KQkq - 0 1",  // nine pawns
+    "P3k3/8/8/8/8/8/8/4K3 w - - 0 1",                             // pawns on the back rank
+    "4k3/8/8/8/8/8/8/p3K3 w - - 0 1",
+    "4k2p/8/8/8/8/8/8/4K3 b - - 0 1",
+    /* side to move */
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR W KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR wb KQkq - 0 1",
+    "4k3/8/8/8/8/8/8/r3K3 b - - 0 1",                             // side not to move in check
+    "4k3/8/8/8/8/5n2/8/4K3 b - - 0 1",
+    "4k3/3P4/8/8/8/8/8/4K3 w - - 0 1",
+    /* castling */
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkz - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkqK - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w K-kq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w -- - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w Ii - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w Ee - 0 1",     // the king file
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w Bb - 0 1",     // no rook there
+    "1nbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",   // rook gone
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQ1BNR w KQkq - 0 1",
+    "rnbq1bnr/ppppkppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",   // king off the back rank
+    /* en passant */
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1",  // no pawn moved
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e6 0 1", // wrong rank for the side
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq d3 0 1", // no pawn in front
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq i3 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e33 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/4N3/PPPP1PPP/RNBQKB1R b KQkq e3 0 1", // square occupied
+    /* counters */
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - -1 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 0",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 10000",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0x 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1x",
+};
+
+/* what load_fen() promises for any position it accepts */
+static bool check_position(game_st *p_game, const char *fen)
+{
+    static game_st s_other;
+    char normal[FEN_BUFF_LEN + 8];
+    uint32_t failures = u32_failures;
+
+    for (uint8_t color = BLACK; color <= WHITE; color++)
+    {
+        uint8_t kings = 0;
+
+        for (uint8_t n = 0; n < p_game->piece_count[color]; n++) {
+            uint8_t piece = p_game->board[p_game->pieces[color][n]];
+            kings += (MAKE_PIECE(color, KING) == piece);
+            CHECK((0 != piece) && (PIECE_COLOR(piece) == color), "%s: piece list", fen);
+            CHECK((PAWN != PIECE_TYPE(piece)) || ((RANK(p_game->pieces[color][n]) != RANK_1) &&
+                (RANK(p_game->pieces[color][n]) != RANK_8)), "%s: pawn on the back rank", fen);
+        }
+        CHECK((1 == kings) && (MAKE_PIECE(color, KING) == p_game->board[p_game->stats.kings[color]]), "%s: kings", fen);
+    }
+    CHECK(!KING_ATTACKED(p_game, SWAP_COLOR(p_game->stats.turn)), "%s: side not to move in check", fen);
+    CHECK(p_game->stats.key == position_key(p_game), "%s: key", fen);
+    CHECK(p_game->stats.move_number > 0, "%s: move number", fen);
+
+    if (p_game->stats.ep_square) {
+        uint8_t them = SWAP_COLOR(p_game->stats.turn);
+        uint8_t pawn = p_game->stats.ep_square + ((WHITE == them) ? -16 : 16);
+        CHECK((0 == p_game->board[p_game->stats.ep_square]) && (MAKE_PIECE(them, PAWN) == p_game->board[pawn]),
+            "%s: en passant", fen);
+    }
+
+    /* the normalised FEN loads to the same position */
+    format_fen(p_game, normal);
+    CHECK(load_fen(&s_other, normal) && (s_other.stats.key == p_game->stats.key) &&
+        (0 == memcmp(s_other.board, p_game->board, sizeof(p_game->board))), "%s: reloaded as %s", fen, normal);
+
+    uint64_t key = p_game->stats.key;
+    perft(p_game, 2);
+    CHECK(key == p_game->stats.key, "%s: key after perft", fen);
+
+    return failures == u32_failures;
+}
+
+/* seeded mutations of the valid FENs: replaced, inserted, deleted or swapped characters, truncation */
+static void fuzz(uint32_t count)
+{
+    static const char ALPHABET[] = "pnbrqkPNBRQK12345678/ wb-KQkqABCDEFGHabcdefgh0123456789";
+    static game_st s_game;
+    char fen[FEN_BUFF_LEN + 8];
+    uint32_t accepted = 0;
+
+    srand(20);
+    for (uint32_t n = 0; n < count; n++)
+    {
+        const char *base = VALID_FENS[n % (sizeof(VALID_FENS) / sizeof(VALID_FENS[0]))];
+        size_t len = strlen(base);
+
+        memcpy(fen, base, len + 1);
+        for (uint8_t edits = 1 + (rand() % 3); (edits > 0) && (len > 0); edits--)
+        {
+            size_t pos = rand() % len;
+            char   ch = ALPHABET[rand() % (sizeof(ALPHABET) - 1)];
+
+            switch (rand() % 5) {
+            case 0:
+                fen[pos] = ch;
+                break;
+            case 1:
+                if (len + 1 < sizeof(fen)) {
+                    memmove(&fen[pos + 1], &fen[pos], len - pos + 1);
+                    fen[pos] = ch;
+                    len++;
+                }
+                break;
+            case 2:
+                memmove(&fen[pos], &fen[pos + 1], len - pos);
+                len--;
+                break;
+            case 3:
+                if (pos + 1 < len) {
+                    ch = fen[pos];
+                    fen[pos] = fen[pos + 1];
+                    fen[pos + 1] = ch;
+                }
+                break;
+            default:
+                fen[pos] = '\0';
+                len = pos;
+                break;
+            }
+        }
+
+        if (load_fen(&s_game, fen)) {
+            accepted++;
+            if (!check_position(&s_game, fen))
+                break;
+        }
+    }
+
+    CHECK(accepted > 0, "no mutation accepted");
+    printf("fuzz: %u of %u mutations accepted\n", accepted, count);
+}
+
+int main(void)
+{
+    static game_st s_game;
+    char fen[FEN_BUFF_LEN + 8];
+
+    for (const char *elt : VALID_FENS) {
+        CHECK(load_fen(&s_game, elt) && check_position(&s_game, elt), "valid %s", elt);
+        format_fen(&s_game, fen);
+        CHECK(0 == strcmp(fen, elt), "round trip %s, got %s", elt, fen);
+    }
+    for (const auto &elt : NORMAL_FENS) {
+        CHECK(load_fen(&s_game, elt.fen), "valid %s", elt.fen);
+        format_fen(&s_game, fen);
+        CHECK(0 == strcmp(fen, elt.normal), "%s normalised to %s", elt.fen, fen);
+    }
+    for (const char *elt : REJECTED_FENS) {
+        CHECK(!load_fen(&s_game, elt), "accepted %s", elt);
+    }
+
+    /* the fields land where they should */
+    CHECK(load_fen(&s_game, "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 12 34") &&
+        (BLACK == s_game.stats.turn) && (e3 == s_game.stats.ep_square) && (12 == s_game.stats.half_moves) &&
+        (34 == s_game.stats.move_number) && (e1 == s_game.stats.kings[WHITE]) && (e8 == s_game.stats.kings[BLACK]),
+        "fields");
+
+    fuzz(20000);
+
+    return TEST_EXIT();
+}
@@ -0,0 +1,190 @@
+#include "test.h"
+#include "chess/chess_moves.cpp" // white box, add_move() and the board helpers are static
+
+using namespace chess;
+
+static const char *TREE_POSITIONS[] = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "1r2k1r1/8/8/8/8/8/8/R3K1R1 w GAgb - 0 1",
+};
+
+/* promotions, capture-promotions and en passant */
+static const char *PIECES_POSITIONS[] = {
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+};
+
+static uint32_t au32_visited[3]; // promotions, capture-promotions, en passant
+
+static void test_add_move(void)
+{
+    static game_st      s_game;
+    static move_list_st s_list;
+    seen_st seen;
+
+    load_fen(&s_game, "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+    seen.from = 0xFF;
+    s_list.count = 0;
+
+    add_move(&s_game, &s_list, &seen, e1, f1, BIT_NORMAL);
+    add_move(&s_game, &s_list, &seen, e1, f1, BIT_NORMAL);
+    CHECK(1 == s_list.count, "same move added twice, %u stored", s_list.count);
+
+    add_move(&s_game, &s_list, &seen, e1, d1, BIT_NORMAL);
+    add_move(&s_game, &s_list, &seen, e1, g1, BIT_NORMAL);
+    add_move(&s_game, &s_list, &seen, e1, g1, BIT_KSIDE_CASTLE); // same squares as a king move (chess960)
+    add_move(&s_game, &s_list, &seen, e1, g1, BIT_NORMAL);
+    CHECK(4 == s_list.count, "other targets and castling, %u stored", s_list.count);
+
+    add_move(&s_game, &s_list, &seen, a1, d1, BIT_NORMAL); // same target, other origin
+    CHECK(5 == s_list.count, "other origin, %u stored", s_list.count);
+}
+
+/* no two generated moves with the same squares, but for castling */
+static void walk_duplicates(game_st *p_game, uint8_t depth)
+{
+    move_list_st list;
+
+    generate_moves(p_game, &list);
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        const move_st *a = &list.moves[i];
+        for (uint8_t j = i + 1; j < list.count; j++) {
+            const move_st *b = &list.moves[j];
+            CHECK((a->from != b->from) || (a->to != b->to) || ((a->flags ^ b->flags) & BITS_CASTLE),
+                "duplicate %c%u%c%u, key %016llx", ALGEBRAIC(a->from), ALGEBRAIC(a->to), (unsigned long long)p_game->stats.key);
+        }
+        if (depth > 1) {
+            make_move(p_game, a);
+            walk_duplicates(p_game, depth - 1);
+            undo_move(p_game);
+        }
+    }
+}
+
+/* changed_squares() against a square by square compare, on random edits of the scan */
+static void test_changed_squares(void)
+{
+    static const uint8_t PIECES[] = { 0, 'p', 'n', 'b', 'r', 'q', 'k', 'P', 'N', 'B', 'R', 'Q', 'K' };
+    static game_st s_game;
+    uint8_t scan[64];
+
+    srand(7);
+    for (const char *fen : PIECES_POSITIONS)
+    {
+        load_fen(&s_game, fen);
+        for (uint32_t n = 0; n < 2000; n++)
+        {
+            uint64_t expected = 0;
+
+            for (uint8_t idx = 0; idx < 64; idx++) {
+                scan[idx] = s_game.board[IDX_TO_SQUARE(idx)];
+            }
+            for (uint8_t edits = n % 6; edits > 0; edits--) {
+                scan[rand() & 63] = PIECES[rand() % sizeof(PIECES)];
+            }
+            for (uint8_t idx = 0; idx < 64; idx++) {
+                if (scan[idx] != s_game.board[IDX_TO_SQUARE(idx)]) {
+                    expected |= 1ULL << idx;
+                }
+            }
+            CHECK(expected == changed_squares(&s_game, scan), "changed %016llx, expected %016llx",
+                (unsigned long long)changed_squares(&s_game, scan), (unsigned long long)expected);
+        }
+    }
+}
+
+/* piece lists and bitboards against board[] */
+static void check_pieces(const game_st *p_game)
+{
+    for (uint8_t color = BLACK; color <= WHITE; color++)
+    {
+        uint8_t count = 0;
+
+        for (uint8_t sq = a8; sq <= h1; sq++) {
+            uint8_t piece = p_game->board[sq];
+            if ((sq & 0x88) || (0 == piece) || (PIECE_COLOR(piece) != color))
+                continue;
+            count++;
+            CHECK(p_game->pieces[color][p_game->piece_index[sq]] == sq, "%c on %c%u not listed", piece, ALGEBRAIC(sq));
+#if BITBOARDS
+            CHECK(p_game->bitboards[color][BB_INDEX(PIECE_TYPE(piece))] & BB_SQUARE(sq), "%c on %c%u not in its bitboard", piece, ALGEBRAIC(sq));
+#endif
+        }
+        CHECK(count == p_game->piece_count[color], "%u pieces listed for %u on the board", p_game->piece_count[color], count);
+        for (uint8_t n = 0; n < p_game->piece_count[color]; n++) {
+            uint8_t sq = p_game->pieces[color][n];
+            CHECK((0 != p_game->board[sq]) && (PIECE_COLOR(p_game->board[sq]) == color) && (p_game->piece_index[sq] == n),
+                "stale slot %u on %c%u", n, ALGEBRAIC(sq));
+        }
+        CHECK(p_game->board[p_game->stats.kings[color]] == MAKE_PIECE(color, KING), "king of %u", color);
+#if BITBOARDS
+        uint64_t occupied = 0;
+        for (uint8_t type = 0; type < 6; type++) {
+            occupied |= p_game->bitboards[color][type];
+        }
+        CHECK((occupied == p_game->occupied[color]) && ((uint8_t)__builtin_popcountll(occupied) == count), "occupancy of %u", color);
+#endif
+    }
+}
+
+static void walk_pieces(game_st *p_game, uint8_t depth)
+{
+    static const uint8_t PROMOTIONS[] = { QUEEN, ROOK, BISHOP, KNIGHT };
+    move_list_st list;
+    uint8_t      board[128];
+
+    memcpy(board, p_game->board, sizeof(board));
+    generate_moves(p_game, &list);
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        move_st *move = &list.moves[i];
+        uint8_t  promotions = (move->flags & BIT_PROMOTION) ? sizeof(PROMOTIONS) : 1;
+
+        for (uint8_t j = 0; j < promotions; j++)
+        {
+            if (move->flags & BIT_PROMOTION) {
+                move->promoted = PROMOTIONS[j];
+                au32_visited[(move->flags & BIT_CAPTURE) ? 1 : 0]++;
+            } else if (move->flags & BIT_EP_CAPTURE) {
+                au32_visited[2]++;
+            }
+
+            make_move(p_game, move);
+            check_pieces(p_game);
+            if (depth > 1) {
+                walk_pieces(p_game, depth - 1);
+            }
+            undo_move(p_game);
+            check_pieces(p_game);
+            CHECK(0 == memcmp(board, p_game->board, sizeof(board)), "board not restored");
+        }
+    }
+}
+
+int main(void)
+{
+    static game_st s_game;
+
+    test_add_move();
+    test_changed_squares();
+
+    for (const char *fen : PIECES_POSITIONS) {
+        CHECK(load_fen(&s_game, fen), "load_fen %s", fen);
+        check_pieces(&s_game);
+        walk_pieces(&s_game, 3);
+    }
+    CHECK(au32_visited[0] && au32_visited[1] && au32_visited[2], "visited %u promotions, %u capture-promotions, %u en passant",
+        au32_visited[0], au32_visited[1], au32_visited[2]);
+
+    for (const char *fen : TREE_POSITIONS) {
+        CHECK(load_fen(&s_game, fen), "load_fen %s", fen);
+        walk_duplicates(&s_game, 3);
+    }
+
+    return TEST_EXIT();
+}
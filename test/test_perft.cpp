@@ -0,0 +1,68 @@
+#include <chrono>
+
+#include "test.h"
+
+using namespace chess;
+
+typedef struct {
+    const char *fen;
+    uint8_t     depth;
+    uint32_t    nodes;
+} perft_case_st;
+
+/* leaf counts from chessprogramming.org and the chess960 perft suite,
+   cross-checked with an independent brute-force generator */
+static const perft_case_st PERFT_CASES[] = {
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",                  5, 4865609 },
+    { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",      4, 4085603 }, // kiwipete
+    { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",      5, 193690690 },
+    { "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",                                 5,  674624 }, // en passant, pins
+    { "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",          4,  422333 }, // promotions
+    { "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",          4,  422333 }, // mirrored
+    { "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",                 4, 2103487 },
+    { "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",  4, 3894594 },
+    /* chess960, Shredder-FEN castling */
+    { "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9",         4,  326672 },
+    { "b1q1rrkb/pppppppp/3nn3/8/P7/1PPP4/4PPPP/BQNNRKRB w GE - 1 9",               4,  273318 },
+    { "qbbnnrkr/2pp2pp/p7/1p2pp2/8/P3PP2/1PPP1KPP/QBBNNR1R w hf - 0 9",            4,  382958 },
+    { "1nbbnrkr/p1p1ppp1/3p4/1p3P1p/3Pq2P/8/PPP1P1P1/QNBBNRKR w HFhf - 0 9",       4, 1171749 },
+    { "qnbnr1kr/ppp1b1pp/4p3/3p1p2/8/2NPP3/PPP1BPPP/QNB1R1KR w HEhe - 1 9",        4,  824055 },
+    { "q1bnrkr1/ppppp2p/2n2p2/4b1p1/2NP4/8/PPP1PPPP/QNB1RRKB w ge - 1 9",          4,  732757 },
+    { "qbn1brkr/ppp1p1p1/2n4p/3p1p2/P7/6PP/QPPPPP2/1BNNBRKR w HFhf - 0 9",         4,  465806 },
+    { "qnnbbrkr/1p2ppp1/2pp3p/p7/1P5P/2NP4/P1P1PPP1/Q1NBBRKR w HFhf - 0 9",        4,  384260 },
+    { "qn1rbbkr/ppp2p1p/1n1pp1p1/8/3P4/P6P/1PP1PPPK/QNNRBB1R w hd - 2 9",          4,  679699 },
+    { "1r2k1r1/8/8/8/8/8/8/R3K1R1 w GAgb - 0 1",                                  4,  308556 }, // king on the castled square
+    { "r1k1r3/8/8/8/8/8/8/RK4R1 w GAea - 0 1",                                    4,  253061 }, // rook next to the king
+    { "5rkr/8/8/8/8/8/8/5RKR w HFhf - 0 1",                                       4,  142655 }, // rooks on both sides of the king
+    { "rk5r/8/8/8/8/8/8/RK5R w AHah - 0 1",                                       4,  242723 },
+};
+
+int main(void)
+{
+    static game_st s_game;
+    uint64_t u64_nodes = 0;
+    double   d_seconds = 0;
+
+    for (const perft_case_st &c : PERFT_CASES)
+    {
+        if (!load_fen(&s_game, c.fen)) {
+            CHECK(false, "load_fen %s", c.fen);
+            continue;
+        }
+
+        uint64_t key = s_game.stats.key;
+        auto     t_start = std::chrono::steady_clock::now();
+        uint32_t nodes = perft(&s_game, c.depth);
+        double   seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+        printf("%-76s d%u %9u %6.1f Mnps\n", c.fen, c.depth, nodes, nodes / seconds / 1e6);
+        CHECK(c.nodes == nodes, "expected %u nodes", c.nodes);
+        CHECK(key == s_game.stats.key, "position not restored");
+        u64_nodes += nodes;
+        d_seconds += seconds;
+    }
+
+    printf("%llu nodes, %.1f Mnps\n", (unsigned long long)u64_nodes, u64_nodes / d_seconds / 1e6);
+
+    return TEST_EXIT();
+}
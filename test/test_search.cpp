@@ -0,0 +1,59 @@
+#include "test.h"
+
+using namespace chess;
+
+#define MATE_IN(moves)                  (SEARCH_MATE - (2 * (moves) - 1))
+
+/* best move and score at a fixed depth, the time budget never runs out */
+static const struct {
+    const char *fen;
+    uint8_t     depth;
+    const char *best;           // UCI, NULL if several are as good
+    int16_t     score;          // exact for mates, else a lower bound
+    const char *name;
+} SEARCH_POSITIONS[] = {
+    { "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",                             2, "d1d8", MATE_IN(1), "back rank" },
+    { "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4", 2, "h5f7", MATE_IN(1), "scholar's mate" },
+    { "7k/4Q3/6K1/8/8/8/8/8 w - - 0 1",                                     3, NULL,   MATE_IN(1), "mate, not stalemate" },
+    { "7k/8/8/8/8/8/R7/1R4K1 w - - 0 1",                                   4, NULL,   MATE_IN(2), "rook ladder" },
+    { "4k3/8/8/3q4/8/8/8/3RK3 w - - 0 1",                                  3, "d1d5", 400,        "hanging queen" },
+    { "4k3/1r6/8/8/4N3/8/P7/4K3 w - - 0 1",                                4, "e4d6", 150,        "knight fork" },
+};
+
+static bool play_uci(const move_st *move, const char *uci)
+{
+    return (move->from == ((('8' - uci[1]) << 4) | (uci[0] - 'a'))) && (move->to == ((('8' - uci[3]) << 4) | (uci[2] - 'a')));
+}
+
+int main(void)
+{
+    static game_st s_game;
+    search_result_st result;
+
+    CHECK(search_init(16), "search_init");
+
+    for (const auto &pos : SEARCH_POSITIONS)
+    {
+        CHECK(load_fen(&s_game, pos.fen), "load_fen %s", pos.fen);
+        uint64_t key = s_game.stats.key;
+
+        CHECK(search(&s_game, 60000, pos.depth, &result), "%s: no move", pos.name);
+        CHECK((NULL == pos.best) || play_uci(&result.best, pos.best), "%s: %c%u%c%u, expected %s", pos.name,
+            ALGEBRAIC(result.best.from), ALGEBRAIC(result.best.to), pos.best);
+        CHECK((pos.score > SEARCH_MATE - SEARCH_MAX_PLY) ? (pos.score == result.score) : (pos.score <= result.score),
+            "%s: score %d, expected %d", pos.name, result.score, pos.score);
+        CHECK((key == s_game.stats.key) && (0 == s_game.plies), "%s: position not restored", pos.name);
+    }
+
+    /* no move to search: stalemate and mate */
+    load_fen(&s_game, "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1");
+    CHECK(!search(&s_game, 60000, 4, &result) && (0 == result.score), "stalemate, score %d", result.score);
+    load_fen(&s_game, "5Q1k/8/6K1/8/8/8/8/8 b - - 0 1");
+    CHECK(!search(&s_game, 60000, 4, &result) && (-SEARCH_MATE == result.score), "mated, score %d", result.score);
+
+    /* out of time: the first iteration stands */
+    load_fen(&s_game, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    CHECK(search(&s_game, 0, 20, &result) && (result.depth >= 1) && (result.depth < 20), "budget, depth %u", result.depth);
+
+    return TEST_EXIT();
+}
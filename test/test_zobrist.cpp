@@ -0,0 +1,104 @@
+#include "test.h"
+
+using namespace chess;
+
+static const char *ZOBRIST_POSITIONS[] = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",  // castling rights lost
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",      // promotions
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",                             // en passant
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9",    // chess960
+};
+
+static const char *STANDARD_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"; // START_FEN is in chess.cpp
+
+static uint32_t au32_visited[3]; // castling rights changed, en passant square set, promotions
+
+/* the incremental key against a full recompute at every node */
+static void walk_keys(game_st *p_game, uint8_t depth)
+{
+    static const uint8_t PROMOTIONS[] = { QUEEN, ROOK, BISHOP, KNIGHT };
+    move_list_st list;
+    uint64_t     key = p_game->stats.key;
+
+    CHECK(key == position_key(p_game), "key %016llx, recomputed %016llx", (unsigned long long)key,
+        (unsigned long long)position_key(p_game));
+    if (0 == depth)
+        return;
+
+    generate_moves(p_game, &list);
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        move_st *move = &list.moves[i];
+        uint8_t  promotions = (move->flags & BIT_PROMOTION) ? sizeof(PROMOTIONS) : 1;
+
+        for (uint8_t j = 0; j < promotions; j++)
+        {
+            uint16_t castling = (p_game->stats.castling[WHITE] << 8) | p_game->stats.castling[BLACK];
+
+            move->promoted = (move->flags & BIT_PROMOTION) ? PROMOTIONS[j] : 0;
+            make_move(p_game, move);
+
+            au32_visited[0] += castling != ((p_game->stats.castling[WHITE] << 8) | p_game->stats.castling[BLACK]);
+            au32_visited[1] += (0 != p_game->stats.ep_square);
+            au32_visited[2] += (0 != move->promoted);
+
+            walk_keys(p_game, depth - 1);
+            undo_move(p_game);
+            CHECK(key == p_game->stats.key, "key not restored by undo_move");
+        }
+    }
+}
+
+/* plays the space separated SAN moves */
+static bool play(game_st *p_game, const char *fen, const char *moves)
+{
+    move_list_st list;
+    move_st      move;
+    char         san[8];
+
+    load_fen(p_game, fen);
+    while (1 == sscanf(moves, "%7s", san))
+    {
+        generate_moves(p_game, &list);
+        if (!parse_move(&list, san, &move))
+            return false;
+        make_move(p_game, &move);
+        moves = strchr(moves, ' ');
+        if (NULL == moves)
+            break;
+        moves++;
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    static game_st s_game;
+
+    for (const char *fen : ZOBRIST_POSITIONS) {
+        CHECK(load_fen(&s_game, fen), "load_fen %s", fen);
+        walk_keys(&s_game, 4);
+    }
+    CHECK(au32_visited[0] && au32_visited[1] && au32_visited[2], "visited %u castling changes, %u en passant, %u promotions",
+        au32_visited[0], au32_visited[1], au32_visited[2]);
+
+    /* same position through other move orders, en passant only counted when the capture is possible */
+    static game_st other;
+    CHECK(play(&s_game, STANDARD_FEN, "Nf3 Nf6 Nc3 Nc6") && play(&other, STANDARD_FEN, "Nc3 Nc6 Nf3 Nf6"), "play");
+    CHECK(other.stats.key == s_game.stats.key, "transposition");
+    CHECK(play(&s_game, STANDARD_FEN, "Nf3 Nf6 Ng1 Ng8"), "play");
+    load_fen(&other, STANDARD_FEN);
+    CHECK(other.stats.key == s_game.stats.key, "knights back");
+    CHECK(play(&s_game, STANDARD_FEN, "e4 Nf6 e5 d5"), "play");
+    load_fen(&other, "rnbqkb1r/ppp1pppp/5n2/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq - 0 3");
+    CHECK(other.stats.key != s_game.stats.key, "en passant capture possible, key without it");
+
+    load_fen(&other, "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+    CHECK(other.stats.key == position_key(&other), "key of a loaded en passant square");
+    load_fen(&s_game, "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1");
+    CHECK(other.stats.key == s_game.stats.key, "en passant square without a capture changes the key");
+
+    return TEST_EXIT();
+}